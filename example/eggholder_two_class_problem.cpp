@@ -166,7 +166,7 @@ int main(int argc, char** argv){
 
         std::cout << "ITERATION -- " << iteration << std::endl;
         for(int i = 0; i < 2; i++)
-            std::cout << "class " << i << " : " << gmm.model()[i].size()
+            std::cout << "class " << i << " : " << gmm.component_store().size(i)
                       << " : " << gmm.get_samples().get_data(i).size()
                       << " : " << errors[i] << std::endl;
         std::cout << "ERROR = " << error << std::endl;
@@ -34,7 +34,7 @@ Eigen::VectorXd compute_histogram(const std::vector<uint8_t> &digit,int bins){
 
 int main(int argc, char** argv){
 
-    if(argc != 7){
+    if(argc != 7 && argc != 8){
         std::cout << "Usage : " << std::endl;
         std::cout << "\t - location of MNIST dataset" << std::endl;
         std::cout << "\t - batch size" << std::endl;
@@ -42,12 +42,14 @@ int main(int argc, char** argv){
         std::cout << "\t - alpha" << std::endl;
         std::cout << "\t - loglikelihood enable 0|1" << std::endl;
         std::cout << "\t - max number of components per class" << std::endl;
+        std::cout << "\t - [max number of EM refinement iterations after each epoch, default 0]" << std::endl;
         return 1;
     }
 
     std::string data_location = argv[1];
     int batch_size = std::stoi(argv[2]);
     int nbr_epoch = std::stoi(argv[3]);
+    int em_iterations = argc == 8 ? std::stoi(argv[7]) : 0;
 
     // Load MNIST data
     mnist::MNIST_dataset<std::vector, std::vector<uint8_t>, uint8_t> mnist_dataset =
@@ -77,20 +79,32 @@ int main(int argc, char** argv){
     int i = 0;
     std::chrono::system_clock::time_point timer;
     std::vector<double> errors;
+    long training_time = 0; //time spent in the epochs and in the refinement, to compare the time to reach an accuracy
     while(i < nbr_epoch){
         std::cout << "EPOCH -- " << i << std::endl;
+        timer  = std::chrono::system_clock::now();
         trainer.epoch();
+        training_time += std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now() - timer).count();
+        if(em_iterations > 0){
+            timer  = std::chrono::system_clock::now();
+            int nb_passes = trainer.access_classifier().refine(em_iterations);
+            long refine_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now() - timer).count();
+            training_time += refine_time;
+            std::cout << "refine step, " << nb_passes << " passes, time spent : " << refine_time << std::endl;
+        }
         timer  = std::chrono::system_clock::now();
         error = trainer.test(errors);
         std::cout << "test step, time spent : "
                   << std::chrono::duration_cast<std::chrono::milliseconds>(
                          std::chrono::system_clock::now() - timer).count() << std::endl;
         for(int i = 0; i < 10; i++)
-            std::cout << "class " << i << " : " << trainer.access_classifier().model()[i].size()
+            std::cout << "class " << i << " : " << trainer.access_classifier().component_store().size(i)
                       << " : " << trainer.access_classifier().get_samples().get_data(i).size()
                       << " : " << errors[i] << std::endl;
 //        std::cout << trainer.access_classifier().print_info() << std::endl;
-        std::cout << "ERROR = " << error << std::endl;
+        std::cout << "ERROR = " << error << " TRAINING TIME = " << training_time << std::endl;
         i++;
         if(error < 0.1)
             return 0;
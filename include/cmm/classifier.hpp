@@ -69,6 +69,42 @@ public:
      */
     virtual std::vector<double> compute_estimation (const Eigen::VectorXd& sample) const = 0;
 
+    /**
+     * @brief compute_estimation : Compute the class membership probabilities of a batch of samples.
+     * The default implementation estimates each sample separately.
+     * @param matrix of samples, one sample per column
+     * @param output matrix of probability membership, one row per sample and one column per class
+     */
+    virtual void compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const {
+        estimations.resize(samples.cols(),_nbr_class);
+        auto estimate = [&](size_t i){
+            std::vector<double> estimation = compute_estimation(Eigen::VectorXd(samples.col(i)));
+            estimations.row(i) = Eigen::Map<const Eigen::RowVectorXd>(estimation.data(),estimation.size());
+        };
+#ifdef NO_PARALLEL
+        for(int i = 0; i < samples.cols(); i++)
+            estimate(i);
+#else
+        tbb::parallel_for(tbb::blocked_range<size_t>(0,samples.cols()),
+                          [&](const tbb::blocked_range<size_t>& r){
+            for(size_t i = r.begin(); i != r.end(); i++)
+                estimate(i);
+        });
+#endif
+    }
+
+    /**
+     * @brief compute_estimation : Compute the class membership probabilities of a batch of samples.
+     * Built on the dense version.
+     * @param matrix of samples, one sample per column
+     * @param output a vector per sample of probability membership to each class
+     */
+    void compute_estimation(const Eigen::MatrixXd& samples, std::vector<std::vector<double>>& estimations) const {
+        Eigen::MatrixXd dense_estimations;
+        compute_estimation(samples,dense_estimations);
+        _to_vectors(dense_estimations,estimations);
+    }
+
     /**
      * @brief update the classifier according to the dataset
      */
@@ -91,32 +127,34 @@ public:
 
 
     /**
-     * @brief predict the label of the training dataset
-     * @param training dataset
-     * @param results the prediction of label
+     * @brief predict the label of a dataset
+     * @param dataset
+     * @param results the prediction of label : one row per sample and one column per class
      * @return error of prediction
      */
-    virtual double predict(const Data& data, std::vector<std::vector<double>>& results){
-        results.resize(data.size());
-
-#ifdef NO_PARALLEL
-        for(int i = 0; i < data.size(); i++)
-            results[i] = compute_estimation(data[i].second);
-#else
-        tbb::parallel_for(tbb::blocked_range<size_t>(0,data.size()),
-                          [&](const tbb::blocked_range<size_t>& r){
-            for(size_t i = r.begin(); i != r.end(); i++)
-                results[i] = compute_estimation(data[i].second);
-        });
-#endif
+    virtual double predict(const Data& data, Eigen::MatrixXd& results){
+        compute_estimation(data.get_samples_matrix(),results);
 
         double error = 0;
         for(size_t i = 0; i < data.size(); i++){
-            error = error + 1 - results[i][data[i].first];
+            error = error + 1 - results(i,data[i].first);
         }
         return error/(double)data.size();
     }
 
+    /**
+     * @brief predict the label of a dataset
+     * @param dataset
+     * @param results the prediction of label
+     * @return error of prediction
+     */
+    double predict(const Data& data, std::vector<std::vector<double>>& results){
+        Eigen::MatrixXd dense_results;
+        double error = predict(data,dense_results);
+        _to_vectors(dense_results,results);
+        return error;
+    }
+
     /**
      * @brief add a sample to the training set of the classifier
      * @param sample
@@ -135,7 +173,7 @@ public:
 
     //** Getters & Setters
     const Data& get_samples() const {return _samples;}
-    void set_samples(Data samples){_samples = samples;}
+    virtual void set_samples(Data samples){_samples = samples;}
     int get_nbr_class() const {return _nbr_class;}
     int get_dimension() const {return _dimension;}
 
@@ -147,28 +185,23 @@ public:
     /**
      * @brief compute an estimation of class membership for all the samples in the training dataset
      */
-    void _estimate_training_dataset(){
-        _samples.estimations.resize(_samples.size());
+    virtual void _estimate_training_dataset(){
+        compute_estimation(_samples.get_samples_matrix(),_samples.estimations);
+    }
 
-#ifdef NO_PARALLEL
-        std::vector<double> estimates(_nbr_class);
-        for(int i = 0; i < _samples.size(); i++){
-            estimates = compute_estimation(_samples[i].second);
-            _samples.estimations[i] = estimates;
+protected:
+    /**
+     * @brief convert a matrix of estimations, one row per sample, into a vector of estimations per sample
+     */
+    static void _to_vectors(const Eigen::MatrixXd& dense_estimations, std::vector<std::vector<double>>& estimations){
+        estimations.resize(dense_estimations.rows());
+        for(int i = 0; i < dense_estimations.rows(); i++){
+            estimations[i].resize(dense_estimations.cols());
+            for(int j = 0; j < dense_estimations.cols(); j++)
+                estimations[i][j] = dense_estimations(i,j);
         }
-#else
-        tbb::parallel_for(tbb::blocked_range<size_t>(0,_samples.size()),
-                          [&](const tbb::blocked_range<size_t>& r){
-            std::vector<double> estimates(_nbr_class);
-            for(size_t i = r.begin(); i != r.end(); i++){
-                estimates = compute_estimation(_samples[i].second);
-                _samples.estimations[i] = estimates;
-            }
-        });
-#endif
     }
 
-protected:
     int _nbr_class;
     int _dimension;
     Data _samples;
@@ -0,0 +1,145 @@
+#ifndef COMPILED_MODEL_HPP
+#define COMPILED_MODEL_HPP
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Dense>
+
+#include "component.hpp"
+#include "data.hpp"
+#include "scalar_model.hpp"
+
+namespace cmm {
+
+/**
+ * @brief The CompiledModel class
+ * Immutable snapshot of a trained CMM (CollabMM or IncrementalCollabMM) laid out for serving.
+ * All the components of all the classes are stored in a few contiguous arrays, ordered by class :
+ * the components of class c are the indexes [offsets[c], offsets[c+1]). No pointer is followed during an estimation.
+ * As the snapshot is never modified after its construction it can be shared between threads without lock.
+ * The estimations and the confidence follow the same formulas as CollabMM.
+ */
+class CompiledModel : public InferenceModel{
+public:
+    typedef std::shared_ptr<const CompiledModel> Ptr;
+    typedef std::map<int, std::vector<Component::Ptr>> model_t;
+
+    /**
+     * @brief kind of factor stored for a component
+     */
+    typedef enum factor_type{CHOLESKY,PSEUDO_INVERSE,DIAGONAL} factor_type_t;
+
+    CompiledModel(){}
+
+    /**
+     * @brief compile a trained model
+     * @param a CollabMM or an IncrementalCollabMM
+     */
+    template <class gmm>
+    CompiledModel(const gmm& model){
+        _compile(model.model(),model.get_dimension(),model.get_nbr_class());
+    }
+
+    /**
+     * @brief compile a set of components
+     * @param the components of each class
+     * @param dimension of the feature space
+     * @param number of classes
+     */
+    CompiledModel(const model_t& model, int dimension, int nbr_class){
+        _compile(model,dimension,nbr_class);
+    }
+
+    /**
+     * @brief compute the estimation for a sample
+     * @param sample
+     * @return a vector of probability membership to each class
+     */
+    std::vector<double> compute_estimation(const Eigen::VectorXd& sample) const;
+
+    /**
+     * @brief compute the estimation for a sample
+     * @param sample
+     * @param output probability membership to each class
+     */
+    void compute_estimation(const Eigen::VectorXd& sample, Eigen::VectorXd& estimation) const;
+
+    /**
+     * @brief compute the estimation for a batch of samples
+     * @param matrix of samples, one sample per column
+     * @param output matrix of probability membership, one row per sample and one column per class
+     */
+    void compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const;
+
+    /**
+     * @brief predict the label of a dataset, as Classifier::predict
+     * @param dataset
+     * @param results the prediction of label : one row per sample and one column per class
+     * @return error of prediction
+     */
+    double predict(const Data& data, Eigen::MatrixXd& results) const;
+
+    /**
+     * @brief confidence of classification of a sample : density of the closest component (mahalanobis distance)
+     * normalised by its peak density. Only the classes with at least 5 components are considered, as in CollabMM::confidence.
+     * @param sample
+     * @return a real value representing the confidence of classification
+     */
+    double confidence(const Eigen::VectorXd& sample) const;
+
+    int get_dimension() const {return _dimension;}
+    int get_nbr_class() const {return _nbr_class;}
+    int get_nbr_components() const {return _means.cols();}
+
+    /**
+     * @brief index of the first component of each class, with the total number of components as last element
+     */
+    const std::vector<int>& get_offsets() const {return _offsets;}
+
+private:
+    void _compile(const model_t& model, int dimension, int nbr_class);
+
+    /**
+     * @brief mahalanobis distance of a sample to component k
+     * @param sample
+     * @param index of the component
+     * @param buffer of size dimension
+     */
+    double _distance(const Eigen::VectorXd& sample, int k, Eigen::VectorXd& diff) const;
+
+    /**
+     * @brief mahalanobis distances of a block of samples to component k
+     */
+    void _distances(const Eigen::Ref<const Eigen::MatrixXd>& samples, int k, Eigen::VectorXd& distances) const;
+
+    /**
+     * @brief density from the mahalanobis distance, same guards as Component::compute_multivariate_normal_dist
+     * @param mahalanobis distance
+     * @param log of the constant factor of the density
+     */
+    double _density(double distance, double log_coefficient) const;
+
+    /**
+     * @brief Cholesky factor or pseudo inverse of the full covariance of component k
+     */
+    Eigen::MatrixXd::ConstColsBlockXpr _factor(int k) const {return _factors.middleCols(_factor_indexes[k]*_dimension,_dimension);}
+
+    int _dimension = 0;
+    int _nbr_class = 0;
+    std::vector<int> _offsets; /**<first component of each class, size nbr_class + 1*/
+    Eigen::MatrixXd _means; /**<one mean per column*/
+    Eigen::MatrixXd _factors; /**<dimension x dimension block per component with a full covariance : Cholesky factor L or pseudo inverse*/
+    std::vector<int> _factor_indexes; /**<index of the block of each component in _factors, -1 with a diagonal covariance*/
+    Eigen::MatrixXd _inverse_variances; /**<one column per component, only used with diagonal covariances*/
+    Eigen::VectorXd _log_normalizations; /**<log of the normalization constant of each component : -log_determinant - log(2 pi)*/
+    Eigen::VectorXd _log_coefficients; /**<log of the weight of each component plus its log normalization constant*/
+    Eigen::VectorXd _peak_densities; /**<density of each component at its mean*/
+    std::vector<factor_type_t> _factor_types;
+    std::vector<bool> _consistent; /**<true if the class of the component has at least 5 components*/
+};
+
+}
+
+#endif //COMPILED_MODEL_HPP
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <vector>
+#include <atomic>
 
 #include <eigen3/Eigen/Core>
 #include <eigen3/Eigen/Dense>
@@ -10,6 +11,7 @@
 
 #include <cmm/serialization.hpp>
 #include <boost/serialization/vector.hpp>
+#include <boost/serialization/version.hpp>
 #include <boost/shared_ptr.hpp>
 
 
@@ -36,32 +38,87 @@ public:
     typedef boost::shared_ptr<Component> Ptr;
     typedef boost::shared_ptr<const Component> ConstPtr;
 
+    /**
+     * @brief structure of the covariance matrix.
+     * FULL : dense covariance matrix.
+     * DIAGONAL : only the variances along each axis are kept, O(d) storage and computations.
+     * SPHERICAL : a single variance shared by all the axis, O(d) computations.
+     */
+    typedef enum covariance_type{FULL,DIAGONAL,SPHERICAL} covariance_type_t;
+
     /**
      * @brief default constructor
      */
-    Component(){}
+    Component() : _stamp(++_stamp_counter), _id(++_id_counter){}
 
     /**
      * @brief Basic constructor
      * @param dimension of the feature space
      * @param label of the class
+     * @param structure of the covariance matrix. Default is FULL
+     * @param if true the parameters are computed from running sufficient statistics instead of a rescan of the samples. Default is true
      */
-    Component(int dimension, int lbl)
-        : _dimension(dimension), _label(lbl), _factor(0){}
+    Component(int dimension, int lbl, covariance_type_t cov_type = FULL, bool sufficient_statistics = true)
+        : _dimension(dimension), _factor(0), _label(lbl), _covariance_type(cov_type),
+          _sufficient_statistics(sufficient_statistics), _stamp(++_stamp_counter), _id(++_id_counter){}
 
     /**
      * @brief Copy constructor
      * @param  a component
      */
     Component(const Component& c) :
-        _covariance(c._covariance), _mu(c._mu), _label(c._label),
-        _samples(c._samples), _dimension(c._dimension), _factor(c._factor),
-        _size(c._size)
+        _covariance(c._covariance), _variances(c._variances), _mu(c._mu),
+        _samples(c.get_samples()), _nb_samples(c._nb_samples), _size(c._size), _dimension(c._dimension), _factor(c._factor),
+        _label(c._label), _covariance_type(c._covariance_type),
+        _sufficient_statistics(c._sufficient_statistics), _stat_count(c._stat_count),
+        _stat_mean(c._stat_mean), _stat_scatter(c._stat_scatter), _stat_scatter_diag(c._stat_scatter_diag),
+        _cholesky(c._cholesky), _inverse(c._inverse), _inverse_variances(c._inverse_variances),
+        _log_determinant(c._log_determinant), _singular(c._singular), _fitted(c._fitted),
+        _eigenvalues(c._eigenvalues), _eigenvectors(c._eigenvectors), _spectrum_valid(c._spectrum_valid),
+        _stamp(c._stamp), _id(c._id)
     {}
 
+    /**
+     * @brief Copy assignment
+     * The stamp of c is kept as the parameters are the same, so the densities cached for c stay valid for this component.
+     * The id is not copied : this component keeps its identity in the model it belongs to.
+     * @param  a component
+     */
+    Component& operator=(const Component& c){
+        if(this == &c)
+            return *this;
+        _covariance = c._covariance;
+        _variances = c._variances;
+        _mu = c._mu;
+        _label = c._label;
+        _samples = c.get_samples();
+        _nb_samples = c._nb_samples;
+        _dimension = c._dimension;
+        _factor = c._factor;
+        _size = c._size;
+        _covariance_type = c._covariance_type;
+        _sufficient_statistics = c._sufficient_statistics;
+        _stat_count = c._stat_count;
+        _stat_mean = c._stat_mean;
+        _stat_scatter = c._stat_scatter;
+        _stat_scatter_diag = c._stat_scatter_diag;
+        _cholesky = c._cholesky;
+        _inverse = c._inverse;
+        _inverse_variances = c._inverse_variances;
+        _log_determinant = c._log_determinant;
+        _singular = c._singular;
+        _fitted = c._fitted;
+        _eigenvalues = c._eigenvalues;
+        _eigenvectors = c._eigenvectors;
+        _spectrum_valid = c._spectrum_valid;
+        _stamp = c._stamp;
+        return *this;
+    }
+
     /**
      * @brief update_parameters
-     * Erase the previous parameters and compute them with the samples stored in the component.
+     * Erase the previous parameters and compute them with the samples stored in the component. Without samples the parameters are kept.
+     * With sufficient statistics the samples are not rescanned and the cost is O(d^2) whatever the size of the component.
      * CAUTION: Be sure to have all the training samples before using this function
      */
     void update_parameters();
@@ -72,21 +129,79 @@ public:
 //     * This method consider only the latest sample
 //     */
 //    void update_parameters();
-    double compute_multivariate_normal_dist(Eigen::VectorXd X) const;
+    double compute_multivariate_normal_dist(const Eigen::VectorXd& X) const;
+
+    /**
+     * @brief density of a sample from its mahalanobis distance to the component
+     * @param distance
+     * @return density, 0 if the distance is negative or not a number
+     */
+    double density_from_distance(double distance) const;
+
+    /**
+     * @brief density at the mean of the component, from the cached log determinant of the covariance
+     * @return the largest density of the component
+     */
+    double get_peak_density() const {return density_from_distance(0);}
+
+    /**
+     * @brief compute the density of a batch of samples
+     * @param X matrix of samples, one sample per column
+     * @param output vector of densities, one per sample
+     */
+    void compute_multivariate_normal_dist(const Eigen::Ref<const Eigen::MatrixXd>& X, Eigen::VectorXd& densities) const;
+
+    /**
+     * @brief compute the log-density of a batch of samples
+     * @param X matrix of samples, one sample per column
+     * @param output vector of log-densities, one per sample
+     */
+    void compute_log_multivariate_normal_dist(const Eigen::Ref<const Eigen::MatrixXd>& X, Eigen::VectorXd& log_densities) const;
+
+    /**
+     * @brief merge the component c into this component. The samples of c are appended
+     * and, with sufficient statistics, the count, mean and scatter of both components are combined in O(d^2).
+     * The parameters and their factorization are then computed once.
+     * If the samples of one of the components do not represent it (number of samples different from its size),
+     * the parameters are instead the weighted moment matching of both components (size, mean and covariance).
+     * @param c
+     */
     void merge(const Component::Ptr c);
     Component::Ptr split();
 
 
     //Modifiers
-    void add(Eigen::VectorXd sample){
-        _samples.push_back(sample);
-        _size++;
-    }
-    void clear(){_samples.clear();}
+    void add(Eigen::VectorXd sample);
+    /**
+     * @brief add a block of samples, one per column. The sufficient statistics of the block are computed at once
+     * and combined with the ones of the component.
+     * @param samples
+     */
+    void add_samples(const Eigen::Ref<const Eigen::MatrixXd>& samples);
+    void clear();
 
     //Statistics
     double get_standard_deviation() const;
+    /**
+     * @brief eigen decomposition of the covariance matrix. The decomposition is cached until the next change of the parameters.
+     * @param output eigenvalues in increasing order
+     * @param output eigenvectors, one per column
+     */
     void compute_eigenvalues(Eigen::VectorXd& eigenvalues, Eigen::MatrixXd& eigenvectors) const;
+    const Eigen::VectorXd& get_eigenvalues() const {_update_spectrum(); return _eigenvalues;}
+    const Eigen::MatrixXd& get_eigenvectors() const {_update_spectrum(); return _eigenvectors;}
+
+    /**
+     * @brief eigenvector of the largest eigenvalue of the covariance matrix
+     * @return unit vector
+     */
+    Eigen::VectorXd principal_axis() const;
+
+    /**
+     * @brief ratio between the largest and the smallest eigenvalues of the covariance matrix
+     * @return condition number, infinity if the covariance is singular
+     */
+    double condition_number() const;
     double entropy();
 
     /**
@@ -96,6 +211,13 @@ public:
      */
     double distance(const Eigen::VectorXd& X) const;
 
+    /**
+     * @brief compute the mahalanobis distance of a batch of samples with one triangular solve
+     * @param X matrix of samples, one sample per column
+     * @param output vector of distances, one per sample
+     */
+    void distance(const Eigen::Ref<const Eigen::MatrixXd>& X, Eigen::VectorXd& distances) const;
+
     /**
      * @brief compute intersectation condition of this with comp
      * @param comp
@@ -108,24 +230,62 @@ public:
     double get_factor() const {return _factor;}
     int get_label() const {return _label;}
     const Eigen::VectorXd& get_mu() const {return _mu;}
-    void set_mu(const Eigen::VectorXd& mu){_mu = mu;}
-    const Eigen::VectorXd& get_sample(int i) const {return _samples[i];}
-    const std::vector<Eigen::VectorXd>& get_samples() const {return _samples;}
+    void set_mu(const Eigen::VectorXd& mu){_mu = mu; _fitted = false; _stamp = ++_stamp_counter;}
+    Eigen::MatrixXd::ConstColXpr get_sample(int i) const {return _samples.col(i);}
+    /**
+     * @brief view on the samples of the component stored contiguously, one sample per column
+     */
+    Eigen::Ref<const Eigen::MatrixXd> get_samples() const {return _samples.leftCols(_nb_samples);}
+    int nb_samples() const {return _nb_samples;}
     int size() const {return _size;}
     void set_size(int n){_size = n;}
     int get_dimension() const {return _dimension;}
-    const Eigen::MatrixXd& get_covariance() const {return _covariance;}
-    void set_covariance(const Eigen::MatrixXd& covariance){_covariance = covariance;}
+    Eigen::MatrixXd get_covariance() const;
+    /**
+     * @brief set the covariance matrix. With a DIAGONAL or SPHERICAL covariance only the (averaged) diagonal is kept.
+     * @param covariance
+     */
+    void set_covariance(const Eigen::MatrixXd& covariance);
+
+    /**
+     * @brief set the sufficient statistics to the current mean and covariance, as if they were the ones of the samples of the component,
+     * so that update_parameters gives back the current parameters and the next samples update them. Used to keep parameters fitted otherwise (see CollabMM::refine).
+     * Without sufficient statistics or with less than 5 samples the parameters are still recomputed from the samples.
+     */
+    void set_statistics_from_parameters();
+    const Eigen::VectorXd& get_variances() const {return _variances;}
+    covariance_type_t get_covariance_type() const {return _covariance_type;}
+    double get_log_determinant() const {return _log_determinant;}
+    /**
+     * @brief lower triangular Cholesky factor of a FULL covariance. Empty if the covariance is singular.
+     */
+    const Eigen::MatrixXd& get_cholesky() const {return _cholesky;}
+    bool is_singular() const {return _singular;}
+    /**
+     * @brief identifier of the current parameters (mean and covariance). It changes each time the parameters change
+     * and is never shared by two components, except by a copy with the same parameters.
+     * Used to know if a density computed earlier with this component is still valid.
+     */
+    unsigned long get_stamp() const {return _stamp;}
+    /**
+     * @brief identifier of the component, given at its construction and kept when its parameters change.
+     * A copy has the same id as the original. Not archived : a loaded component gets a new id.
+     */
+    unsigned long get_id() const {return _id;}
+    /**
+     * @brief switch between the update from sufficient statistics and the full recompute from the samples.
+     * @param sufficient statistics mode
+     */
+    void set_sufficient_statistics(bool ss);
+    bool get_sufficient_statistics() const {return _sufficient_statistics;}
     //*/
 
     /**
-     * @brief remove a sample from the component by index
+     * @brief remove a sample from the component by index. The last sample takes its place.
+     * The sufficient statistics are downdated accordingly.
      * @param index of the samples
      */
-    void remove_sample(int i){
-        _samples.erase(_samples.begin() + i);
-        _samples.shrink_to_fit();
-    }
+    void remove_sample(int i);
 
     /**
      * @brief printable format of the parameters values
@@ -134,7 +294,7 @@ public:
     std::string print_parameters() const;
 
     /**
-     * @brief Compute the true inverse of the covariance. It is assumed that the covariance matrix is invertible
+     * @brief Compute the inverse of the covariance from its cached Cholesky factor, or return the cached pseudo inverse if the covariance is not positive definite
      * @param inverse matrix
      * @param determinant of the covariance matrix
      */
@@ -152,11 +312,29 @@ public:
     void serialize(archive& arch, const unsigned int v){
         boost::serialization::serialize(arch,_covariance,v);
         boost::serialization::serialize(arch,_mu,v);
-        arch & _samples;
+        samples_t samples; //archived as a vector of samples
+        if(!archive::is_loading::value)
+            for(int i = 0; i < _nb_samples; i++)
+                samples.push_back(_samples.col(i));
+        arch & samples;
         arch & _dimension;
         arch & _factor;
         arch & _label;
         arch & _size;
+        if(v >= 1){
+            int cov_type = _covariance_type;
+            arch & cov_type;
+            _covariance_type = static_cast<covariance_type_t>(cov_type);
+            boost::serialization::serialize(arch,_variances,v);
+        }
+        if(archive::is_loading::value){
+            _nb_samples = 0;
+            _reserve(samples.size());
+            for(const auto& s : samples)
+                _samples.col(_nb_samples++) = s;
+            _rebuild_statistics();
+            _update_factorization();
+        }
     }
 
     /**
@@ -165,6 +343,14 @@ public:
      */
     void _incr_parameters(const Eigen::VectorXd& X);
 
+    /**
+     * @brief remove the sample of index i from the dataset and then do a decremental update of the parameters.
+     * Inverse operation of _incr_parameters. The mean and the Cholesky factor are downdated in O(d^2) if the parameters are the ones
+     * computed by update_parameters from the sufficient statistics, otherwise they are recomputed with update_parameters.
+     * @param index of the sample
+     */
+    void _decr_parameters(int i);
+
     static double _alpha; /**<hyperparameters controlling the sensibility of intersection criterion*/
 
 
@@ -174,15 +360,108 @@ private:
      */
     void _check_samples();
 
-    Eigen::MatrixXd _covariance; /**<covariance matrix of the normal distribution encoding the component*/
+    /**
+     * @brief grow the storage of the samples to hold at least n samples. The capacity is at least doubled to amortize the reallocations.
+     * @param n
+     */
+    void _reserve(int n);
+
+    /**
+     * @brief set the covariance to the default one : identity matrix
+     */
+    void _reset_covariance();
+
+    /**
+     * @brief add a sample to the sufficient statistics with the Welford recursion
+     * @param sample
+     */
+    void _accumulate(const Eigen::VectorXd& sample);
+
+    /**
+     * @brief combine the sufficient statistics of another component with the ones of this component (Chan et al. formula)
+     * @param component
+     */
+    void _accumulate(const Component& c);
+
+    /**
+     * @brief combine the sufficient statistics of a set of samples with the ones of this component (Chan et al. formula)
+     * @param number of samples
+     * @param mean of the samples
+     * @param scatter matrix of the samples (FULL covariance)
+     * @param diagonal of the scatter matrix of the samples (DIAGONAL covariance)
+     */
+    void _accumulate(int count, const Eigen::VectorXd& mean, const Eigen::MatrixXd& scatter, const Eigen::VectorXd& scatter_diag);
+
+    /**
+     * @brief compute the sufficient statistics from scratch with the samples stored in the component
+     */
+    void _rebuild_statistics();
+
+    /**
+     * @brief remove a sample from the sufficient statistics with the reverse Welford recursion
+     * @param sample
+     */
+    void _remove_from_statistics(const Eigen::VectorXd& sample);
+
+    /**
+     * @brief compute the Cholesky factor and the log-determinant of the covariance matrix.
+     * If the covariance is not positive definite, its pseudo inverse is cached instead.
+     * Must be called each time the covariance matrix is modified.
+     */
+    void _update_factorization();
+
+    /**
+     * @brief update the Cholesky factor in O(d^2) after the covariance was changed into scale*covariance + sigma*v*v^T.
+     * A negative sigma is a downdate. Fall back on _update_factorization if the factor is not available
+     * or if the covariance is no longer positive definite.
+     * @param scale
+     * @param v
+     * @param sigma
+     */
+    void _update_factorization(double scale, const Eigen::VectorXd& v, double sigma);
+
+    /**
+     * @brief compute the symmetric eigen decomposition of the covariance matrix if the cached one is not valid anymore.
+     * CAUTION: the cache is filled on the first call, it must not be done concurrently.
+     */
+    void _update_spectrum() const;
+
+    Eigen::MatrixXd _covariance; /**<covariance matrix of the normal distribution encoding the component, only used with a FULL covariance*/
+    Eigen::VectorXd _variances; /**<diagonal of the covariance matrix, only used with a DIAGONAL or SPHERICAL covariance*/
     Eigen::VectorXd _mu; /**<the mean of the normal distribution encoding the component*/
-    std::vector<Eigen::VectorXd> _samples; /**<the dataset on which the parameters of the normal distribution are computed*/
+    Eigen::MatrixXd _samples; /**<the dataset on which the parameters of the normal distribution are computed, one sample per column. Only the _nb_samples first columns are valid*/
+    int _nb_samples = 0; /**<number of samples stored in _samples*/
     int _size = 0; /**<Number of samples in the dataset*/
     int _dimension; /**<the dimension of the multivariate normal distribution*/
     double _factor; /**<the multiplicator factor of the component used when combined in the mixture*/
     int _label; /**<the label of the component corresponding to the class all the samples belong*/
+    covariance_type_t _covariance_type = FULL; /**<structure of the covariance matrix*/
+
+    bool _sufficient_statistics = true; /**<if true the parameters are computed from the following statistics instead of the samples*/
+    int _stat_count = 0; /**<number of samples accumulated in the statistics*/
+    Eigen::VectorXd _stat_mean; /**<running mean of the samples*/
+    Eigen::MatrixXd _stat_scatter; /**<running sum of (x - mean)(x - mean)^T, only used with a FULL covariance*/
+    Eigen::VectorXd _stat_scatter_diag; /**<running sum of (x - mean)^2, only used with a DIAGONAL or SPHERICAL covariance*/
+
+    Eigen::MatrixXd _cholesky; /**<lower triangular factor L of the covariance matrix (covariance = L*L^T)*/
+    Eigen::MatrixXd _inverse; /**<pseudo inverse of the covariance matrix, only used if a FULL covariance is not positive definite*/
+    Eigen::VectorXd _inverse_variances; /**<(pseudo) inverse of the variances, only used with a DIAGONAL or SPHERICAL covariance*/
+    double _log_determinant = 0; /**<log of the (pseudo) determinant of the covariance matrix*/
+    bool _singular = false; /**<true if the covariance matrix is not positive definite*/
+    bool _fitted = false; /**<true if the parameters are the sample mean and covariance computed by update_parameters from the sufficient statistics*/
+
+    mutable Eigen::VectorXd _eigenvalues; /**<cached eigenvalues of the covariance matrix in increasing order*/
+    mutable Eigen::MatrixXd _eigenvectors; /**<cached eigenvectors of the covariance matrix*/
+    mutable bool _spectrum_valid = false; /**<false if the parameters changed since the last eigen decomposition*/
+
+    unsigned long _stamp = 0; /**<identifier of the current parameters*/
+    static std::atomic<unsigned long> _stamp_counter; /**<last stamp given*/
+    unsigned long _id = 0; /**<identifier of the component*/
+    static std::atomic<unsigned long> _id_counter; /**<last id given*/
 };
 
 }
 
+BOOST_CLASS_VERSION(cmm::Component, 1)
+
 #endif //COMPONENT_HPP
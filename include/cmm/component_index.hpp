@@ -0,0 +1,109 @@
+#ifndef COMPONENT_INDEX_HPP
+#define COMPONENT_INDEX_HPP
+
+#include <vector>
+#include <eigen3/Eigen/Core>
+
+#include "component.hpp"
+
+namespace cmm {
+
+/**
+ * @brief The ComponentIndex class
+ * Index over the components of a class to find the closest component of a sample with the mahalanobis distance
+ * without computing the distance to every component. Same result as a linear scan : among equidistant components the one
+ * with the smallest index is returned.
+ *
+ * The components are stored in a kd-tree built on their means. The mahalanobis distance to a component is bounded from below by
+ * the squared euclidean distance to its mean divided by an upper bound of the largest eigenvalue of its covariance (scale).
+ * Each node keeps the largest scale of its components, so a subtree is skipped when the bound is greater than the best distance found.
+ * When the parameters of a component change (update), its mean is not moved in the tree : the distance between its current mean
+ * and the one used to build the tree (drift) is added to the bounds. The tree is rebuilt once there were as many updates as components.
+ */
+class ComponentIndex{
+public:
+
+    ComponentIndex(){}
+
+    /**
+     * @brief build the index over a set of components
+     * @param components
+     * @param maximum number of components in a leaf
+     */
+    ComponentIndex(const std::vector<Component::Ptr>& components, int leaf_size = 8){
+        build(components,leaf_size);
+    }
+
+    /**
+     * @brief (re)build the index over a set of components in O(n log n)
+     * @param components
+     * @param maximum number of components in a leaf
+     */
+    void build(const std::vector<Component::Ptr>& components, int leaf_size = 8);
+
+    /**
+     * @brief refresh the bounds of component k after a change of its parameters, in O(log n)
+     * @param index of the component
+     */
+    void update(int k);
+
+    /**
+     * @brief search the closest component of sample with the mahalanobis distance
+     * @param sample
+     * @param output mahalanobis distance between sample and its closest component
+     * @return index of the closest component, 0 if no distance is finite, -1 if the index is empty
+     */
+    int nearest(const Eigen::VectorXd& sample, double& distance) const;
+
+    /**
+     * @brief true if the index has to be (re)built for the given components : never built, different number of components
+     * or too many updates since the last build.
+     */
+    bool is_stale(const std::vector<Component::Ptr>& components) const {
+        return _components.size() != components.size() || _nb_updates > (int)_components.size();
+    }
+
+    /**
+     * @brief empty the index
+     */
+    void clear();
+
+    size_t size() const {return _components.size();}
+
+private:
+    struct _node_t{
+        int begin; /**<first position in _indexes of the components of the node*/
+        int end; /**<past the end position in _indexes of the components of the node*/
+        int left = -1;
+        int right = -1;
+        int parent = -1;
+        Eigen::VectorXd min_pt; /**<bounding box of the means of the components of the node when the tree was built*/
+        Eigen::VectorXd max_pt;
+        double max_scale = 0; /**<largest scale of the components of the node*/
+        double max_drift = 0; /**<largest drift of the components of the node*/
+    };
+
+    /**
+     * @brief upper bound of the largest eigenvalue of the covariance of a component, infinity if its covariance is singular.
+     */
+    static double _scale(const Component& comp);
+
+    int _build(int begin, int end, int parent);
+    void _refresh(int node);
+    double _lower_bound(int node, const Eigen::VectorXd& sample) const;
+    void _nearest(int node, const Eigen::VectorXd& sample, int& best, double& best_dist) const;
+
+    std::vector<Component::Ptr> _components;
+    Eigen::MatrixXd _means; /**<the means of the components when the tree was built, one per column*/
+    std::vector<double> _scales; /**<upper bound of the largest eigenvalue of the covariance of each component*/
+    std::vector<double> _drifts; /**<distance between the current mean of each component and its mean in _means*/
+    std::vector<int> _leaves; /**<leaf of each component*/
+    std::vector<int> _indexes; /**<permutation of the components indexes sorted by node*/
+    std::vector<_node_t> _nodes;
+    int _leaf_size = 8;
+    int _nb_updates = 0; /**<number of updates since the last build*/
+};
+
+}
+
+#endif //COMPONENT_INDEX_HPP
@@ -0,0 +1,130 @@
+#ifndef COMPONENT_STORE_HPP
+#define COMPONENT_STORE_HPP
+
+#include <map>
+#include <vector>
+#include <unordered_map>
+
+#include "component.hpp"
+
+namespace cmm {
+
+/**
+ * @brief The ComponentStore class
+ * Flat registry of the components of a model : the components of all the classes are stored contiguously, sorted by label,
+ * with the range of each class given by an offset. The global index of a component, its label, its index within its class
+ * and the global index of a component id are all found in O(1).
+ *
+ * The store references the components of the model (map of vectors of components) it was built from, which stays the owner of the structure.
+ * It must be rebuilt after each change of the structure of the model (component added or removed). A change of the parameters of a component
+ * does not invalidate it.
+ * The classifiers invalidate their store when their model is accessed through the non-const model() : the estimators then
+ * build a local store (see component_store in gmm_estimator.hpp) until the next update rebuilds it.
+ */
+class ComponentStore{
+public:
+
+    typedef std::map<int, std::vector<Component::Ptr>> model_t;
+
+    ComponentStore(){}
+
+    /**
+     * @brief build the store from a model
+     * @param model
+     */
+    ComponentStore(const model_t& model){
+        build(model);
+    }
+
+    /**
+     * @brief (re)build the store from a model in O(n)
+     * @param model
+     */
+    void build(const model_t& model);
+
+    /**
+     * @brief mark the store as out of date, for instance when the model is modified from outside
+     */
+    void invalidate(){_valid = false;}
+
+    /**
+     * @brief true if the store was built since the last invalidation
+     */
+    bool is_valid() const {return _valid;}
+
+    /**
+     * @brief empty the store
+     */
+    void clear();
+
+    /**
+     * @brief total number of components
+     */
+    int size() const {return _components.size();}
+
+    /**
+     * @brief number of components of class lbl
+     */
+    int size(int lbl) const {return offset(lbl + 1) - offset(lbl);}
+
+    /**
+     * @brief global index of the first component of class lbl
+     */
+    int offset(int lbl) const {
+        if(lbl < 0)
+            return 0;
+        return lbl < (int)_offsets.size() ? _offsets[lbl] : _components.size();
+    }
+
+    /**
+     * @brief range of the components of class lbl
+     */
+    const Component::Ptr* begin(int lbl) const {return _components.data() + offset(lbl);}
+    const Component::Ptr* end(int lbl) const {return _components.data() + offset(lbl + 1);}
+
+    /**
+     * @brief all the components sorted by label
+     */
+    const std::vector<Component::Ptr>& components() const {return _components;}
+
+    /**
+     * @brief component of global index i
+     */
+    const Component::Ptr& operator[](int i) const {return _components[i];}
+
+    /**
+     * @brief label of the component of global index i
+     */
+    int label(int i) const {return _labels[i];}
+
+    /**
+     * @brief index within its class of the component of global index i
+     */
+    int local_index(int i) const {return i - _offsets[_labels[i]];}
+
+    /**
+     * @brief global index of the component j of class lbl
+     */
+    int global_index(int lbl, int j) const {return offset(lbl) + j;}
+
+    /**
+     * @brief global index of the component with the given id (see Component::get_id)
+     * @param id
+     * @return global index, -1 if no component of the store has this id
+     */
+    int find(unsigned long id) const {
+        auto it = _ids.find(id);
+        return it == _ids.end() ? -1 : it->second;
+    }
+
+private:
+    std::vector<Component::Ptr> _components; /**<the components of all the classes sorted by label*/
+    std::vector<int> _labels; /**<label of each component*/
+    std::vector<int> _offsets; /**<global index of the first component of each label, plus the total number of components*/
+    std::unordered_map<unsigned long,int> _ids; /**<global index of each component id*/
+    bool _valid = false;
+};
+
+}
+
+#endif //COMPONENT_STORE_HPP
@@ -8,6 +8,8 @@
 #include <eigen3/Eigen/Core>
 #include <yaml-cpp/yaml.h>
 
+#include "kdtree.hpp"
+
 namespace cmm{
 
 class Data{
@@ -22,7 +24,7 @@ public:
      */
     typedef std::pair<int,Eigen::VectorXd> element_t;
     typedef std::vector<element_t> data_t;
-    typedef std::vector<std::vector<double>> estimation_t;
+    typedef Eigen::MatrixXd estimation_t; /**<one row per sample and one column per class*/
 
     /**
      * @brief default constructor
@@ -40,7 +42,7 @@ public:
     }
 
     /**
-     * @brief copy constructor
+     * @brief copy constructor. The spatial index is not copied, it is built again by the first knn query on the copy.
      * @param d
      */
     Data(const Data& d) :
@@ -57,6 +59,8 @@ public:
      */
     void add(int label,const Eigen::VectorXd& d){
         _data.push_back(std::make_pair(label,d));
+        if(_indexed)
+            _index.insert(d);
     }
 
 
@@ -66,16 +70,22 @@ public:
      */
     void add(const element_t& elt){
         _data.push_back(elt);
+        if(_indexed)
+            _index.insert(elt.second);
     }
 
 
     /**
-     * @brief erase a sample from the dataset by index
+     * @brief erase a sample from the dataset by index in constant time : the last sample takes the index i.
      * @param index i
      */
     void erase(int i){
-        _data.erase(_data.begin() + i);
-        _data.shrink_to_fit();
+        int last = _data.size() - 1;
+        if(i != last)
+            _data[i] = std::move(_data[last]);
+        _data.pop_back();
+        if(_indexed)
+            _index.remove(i);
     }
 
     /**
@@ -83,6 +93,23 @@ public:
      */
     void clear(){
         _data.clear();
+        _clear_index();
+    }
+
+    /**
+     * @brief search the k nearest samples of center with the euclidean distance, through a kd-tree over the samples.
+     * The tree is built by the first query and then maintained as samples are added or erased.
+     * @param center
+     * @param number of neighbors
+     * @param output indexes of the min(k,size()) nearest samples by increasing distance, the smallest indexes first among equidistant samples
+     */
+    void knn(const Eigen::VectorXd& center, int k, std::vector<int>& indexes){
+        if(!_indexed || _index.size() != _data.size()){
+            _index.build(get_samples_matrix());
+            _indexed = true;
+        }
+        std::vector<double> sq_dists;
+        _index.knn(center,k,indexes,sq_dists);
     }
 
     /**
@@ -124,6 +151,17 @@ public:
         return res;
     }
 
+    /**
+     * @brief gather all the samples in a matrix
+     * @return a matrix with one sample per column, with same indexing as the dataset
+     */
+    Eigen::MatrixXd get_samples_matrix() const{
+        Eigen::MatrixXd res(_data.empty() ? 0 : _data[0].second.rows(),_data.size());
+        for(size_t i = 0; i < _data.size(); i++)
+            res.col(i) = _data[i].second;
+        return res;
+    }
+
     /**
      * @brief access to the last element added.
      * @return constant reference to this element
@@ -173,9 +211,16 @@ public:
 
 
 protected:
+    void _clear_index(){
+        _index.clear();
+        _indexed = false;
+    }
+
     data_t _data; /**<the dataset*/
     int _dimension;/**<the dimension of the samples*/
     int _nbr_class;/**<the number of class*/
+    KDTree _index; /**<spatial index over the samples used by knn*/
+    bool _indexed = false; /**<true if _index is maintained along the additions of samples*/
 };
 
 template <typename D>
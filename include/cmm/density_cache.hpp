@@ -0,0 +1,211 @@
+#ifndef DENSITY_CACHE_HPP
+#define DENSITY_CACHE_HPP
+
+#ifndef NO_PARALLEL
+#include <tbb/tbb.h>
+#endif
+
+#include <map>
+#include <vector>
+#include <cmath>
+#include <eigen3/Eigen/Core>
+
+#include "data.hpp"
+#include "gmm_estimator.hpp"
+
+namespace cmm{
+
+/**
+ * @brief The DensityCache class
+ * Cache of the densities of the training samples under each component of a CMM, used to re-estimate the training dataset
+ * after a structural change of the model (add, split, merge). The densities are kept per component stamp (Component::get_stamp) :
+ * only the components whose parameters changed since the last estimation are evaluated on the whole dataset,
+ * the other ones are only evaluated on the samples added since. The weights of the components are applied at each estimation.
+ * The training samples are assumed to be only appended between two estimations, or removed through erase (as Data::erase). Call clear() otherwise.
+ *
+ * The cache also scores the candidates of a split or a merge (loglikelihood) without copying the model :
+ * only the class sums of the modified class are recomputed, from the cached densities and the ones of the new components.
+ */
+class DensityCache{
+public:
+
+    DensityCache(){}
+
+    /**
+     * @brief estimate the class membership probabilities of the training samples, same result as cmm::estimation.
+     * @param the classifier, either CMM or incremental CMM
+     * @param the training dataset, its estimations are filled
+     */
+    template <class gmm>
+    void estimate(const gmm* model, Data& samples){
+        int nbr_class = model->get_nbr_class();
+        int n = samples.size();
+        if(n < _samples.cols())
+            clear();
+
+        //* gather the new samples
+        int nb_cached = _samples.cols();
+        _samples.conservativeResize(model->get_dimension(),n);
+        for(int i = nb_cached; i < n; i++)
+            _samples.col(i) = samples[i].second;
+        //*/
+
+        std::map<unsigned long,Eigen::VectorXd> densities;
+        Eigen::MatrixXd& sums = samples.estimations;
+        sums = Eigen::MatrixXd::Zero(n,nbr_class);
+        ComponentStore local;
+        const ComponentStore& store = component_store(model,local);
+        for(int i = 0; i < store.size(); i++){
+            const Component::Ptr& comp = store[i];
+            auto current = densities.find(comp->get_stamp());
+            if(current == densities.end()){
+                Eigen::VectorXd dens;
+                auto cached = _densities.find(comp->get_stamp());
+                if(cached != _densities.end())
+                    dens.swap(cached->second);
+                int begin = dens.rows();
+                if(begin < n){
+                    dens.conservativeResize(n);
+                    _compute(*comp,begin,dens);
+                }
+                current = densities.emplace(comp->get_stamp(),std::move(dens)).first;
+            }
+            sums.col(store.label(i)) += comp->get_factor()*current->second;
+        }
+        _densities.swap(densities); //the densities of the components not in the model anymore are dropped
+        _sums = sums;
+
+        Eigen::VectorXd sum_of_sums = sums.rowwise().sum();
+        sums = (sums.array() + 1).colwise()/(sum_of_sums.array() + nbr_class);
+    }
+
+    /**
+     * @brief log-likelihood score, as CollabMM::loglikelihood, of the model in which the components of class lbl
+     * are replaced by components (with the weights update_factors would give them).
+     * The other classes are taken from the last estimation : the cache must be up to date with the model,
+     * i.e. estimate called since its last modification.
+     * Only the densities of the components which are not cached are computed, on the whole training dataset.
+     * They are kept until the next estimation so that an accepted candidate is not evaluated twice.
+     * @param the training dataset
+     * @param label of the modified class
+     * @param the components of class lbl in the candidate model, in order
+     * @return the log-likelihood score of the candidate model
+     */
+    template <class component_ptr_t>
+    double loglikelihood(const Data& samples, int lbl, const std::vector<component_ptr_t>& components){
+        int n = _samples.cols();
+        int nbr_class = _sums.cols();
+
+        double sum_size = 0;
+        for(const auto& comp : components)
+            sum_size += comp->size();
+
+        std::vector<const Eigen::VectorXd*> densities(components.size());
+        std::vector<double> weights(components.size());
+        for(size_t k = 0; k < components.size(); k++){
+            auto cached = _densities.find(components[k]->get_stamp());
+            if(cached == _densities.end()){
+                cached = _densities.emplace(components[k]->get_stamp(),Eigen::VectorXd(n)).first;
+                _compute(*components[k],0,cached->second);
+            }
+            densities[k] = &cached->second;
+            weights[k] = (double)components[k]->size()/sum_size;
+        }
+
+        double score = 0;
+        int nb_samples_0 = 0; //the score is normalised by the number of samples of class 0, as in CollabMM::loglikelihood
+        for(int i = 0; i < n; i++){
+            double class_sum = 0;
+            for(size_t k = 0; k < components.size(); k++)
+                class_sum += weights[k]*(*densities[k])(i);
+
+            double sum_of_sums = 0;
+            for(int c = 0; c < nbr_class; c++)
+                sum_of_sums += c == lbl ? class_sum : _sums(i,c);
+            score += std::log((1 + (lbl == 0 ? class_sum : _sums(i,0)))/(nbr_class + sum_of_sums));
+            if(samples[i].first == 0)
+                nb_samples_0++;
+        }
+        return score/(double)nb_samples_0;
+    }
+
+    /**
+     * @brief remove the training sample of index i from the cache, to follow Data::erase : the last sample takes the index i.
+     * To call before Data::erase.
+     * @param index of the sample
+     * @param size of the training dataset, before the removal
+     */
+    void erase(int i, int nb_samples){
+        int n = _samples.cols();
+        if(i >= n) //the sample was not evaluated yet
+            return;
+        if(n < nb_samples){
+            //the last sample of the dataset was not evaluated yet : the samples from i are evaluated again at the next estimation
+            _resize(i);
+            return;
+        }
+        int last = n - 1;
+        _samples.col(i) = _samples.col(last);
+        for(auto& densities : _densities){
+            Eigen::VectorXd& dens = densities.second;
+            if(dens.rows() == n)
+                dens(i) = dens(last);
+        }
+        if(_sums.rows() == n)
+            _sums.row(i) = _sums.row(last);
+        _resize(last);
+    }
+
+    /**
+     * @brief empty the cache
+     */
+    void clear(){
+        _densities.clear();
+        _samples.resize(0,0);
+        _sums.resize(0,0);
+    }
+
+    /**
+     * @brief number of components for which densities are cached
+     */
+    size_t size() const {return _densities.size();}
+
+private:
+    //keep the first n samples
+    void _resize(int n){
+        _samples.conservativeResize(Eigen::NoChange,n);
+        for(auto& densities : _densities)
+            if(densities.second.rows() > n)
+                densities.second.conservativeResize(n);
+        if(_sums.rows() > n)
+            _sums.conservativeResize(n,Eigen::NoChange);
+    }
+
+    /**
+     * @brief compute the densities of the samples from index begin to the end
+     */
+    template <class component_t>
+    void _compute(const component_t& comp, int begin, Eigen::VectorXd& densities){
+        auto compute_block = [&](size_t b, size_t e){
+            Eigen::VectorXd block_densities;
+            comp.compute_multivariate_normal_dist(_samples.middleCols(b,e-b),block_densities);
+            densities.segment(b,e-b) = block_densities;
+        };
+#ifdef NO_PARALLEL
+        compute_block(begin,_samples.cols());
+#else
+        tbb::parallel_for(tbb::blocked_range<size_t>(begin,_samples.cols(),256),
+                          [&](const tbb::blocked_range<size_t>& r){
+            compute_block(r.begin(),r.end());
+        });
+#endif
+    }
+
+    std::map<unsigned long,Eigen::VectorXd> _densities; /**<densities of the training samples under each component, by component stamp*/
+    Eigen::MatrixXd _samples; /**<copy of the training samples already evaluated, one sample per column*/
+    Eigen::MatrixXd _sums; /**<weighted sums of the densities of each class from the last estimation, one row per sample*/
+};
+
+}//cmm
+
+#endif //DENSITY_CACHE_HPP
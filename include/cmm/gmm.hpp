@@ -6,6 +6,7 @@
 #include <math.h>
 #include <vector>
 #include <map>
+#include <deque>
 
 #include "boost/random.hpp"
 
@@ -23,6 +24,10 @@
 
 #include "component.hpp"
 #include "classifier.hpp"
+#include "density_cache.hpp"
+#include "component_index.hpp"
+#include "component_store.hpp"
+#include "compiled_model.hpp"
 
 
 namespace cmm{
@@ -33,12 +38,14 @@ public:
 
 
     typedef enum update{BATCH,STOCHASTIC} update_mode_t;
+    typedef enum eviction{OLDEST_FIRST,RESERVOIR} eviction_policy_t;
     typedef std::map<int, std::vector<Component::Ptr>> model_t;
 
     /**
      * @brief default constructor
      */
     CollabMM(){
+        _store.build(_model);
         srand(time(NULL));
         _gen.seed(rand());
         _distance = [](const Eigen::VectorXd& s1,const Eigen::VectorXd& s2) -> double {
@@ -56,6 +63,7 @@ public:
         Classifier(dimension,nbr_class){
         for(int i = 0; i < nbr_class; i++)
             _model.emplace(i,std::vector<Component::Ptr>());
+        _store.build(_model);
 
         srand(time(NULL));
         _gen.seed(rand());
@@ -73,12 +81,14 @@ public:
     CollabMM(const model_t& model){
 
         _dimension = model.at(0)[0]->get_dimension();
+        _covariance_type = model.at(0)[0]->get_covariance_type();
         _nbr_class = model.size();
         for(const auto& comps : model){
             _model.emplace(comps.first,std::vector<Component::Ptr>());
             for(const auto& comp : comps.second)
                 _model[comps.first].push_back(Component::Ptr(new Component(*(comp))));
         }
+        _update_component_lists();
         srand(time(NULL));
         _gen.seed(rand());
         _distance = [](const Eigen::VectorXd& s1,const Eigen::VectorXd& s2) -> double {
@@ -108,10 +118,21 @@ public:
     std::vector<double> compute_estimation(const Eigen::VectorXd& sample) const;
 
     /**
-     * @brief accessor to the model
+     * @brief compute the estimation for a batch of samples, by tiles of samples against all the components
+     * @param matrix of samples, one sample per column
+     * @param output matrix of probability membership, one row per sample and one column per class
+     */
+    void compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const;
+
+    using Classifier::compute_estimation;
+
+    /**
+     * @brief accessor to the model. The model may be modified through it : the component store is then
+     * out of date until the next update, and the estimations list the components at each call.
+     * The indexes of the components are rebuilt at their next use.
      * @return reference to the model
      */
-    model_t& model(){return _model;}
+    model_t& model(){_store.invalidate(); _component_index.clear(); return _model;}
 
     /**
      * @brief constant accessor to the model
@@ -119,6 +140,11 @@ public:
      */
     const model_t& model() const {return _model;}
 
+    /**
+     * @brief flat registry of the components of the model (see ComponentStore). Not valid if the model was modified through model() since the last update.
+     */
+    const ComponentStore& component_store() const {return _store;}
+
     /**
      * @brief add a sample to the model with its label
      * @param sample
@@ -127,25 +153,69 @@ public:
     void add(const Eigen::VectorXd &sample, int lbl);
 
     /**
-     * @brief append a list of samples associated with their labels
+     * @brief add a mini-batch of samples to the model with their labels (see append)
+     * @param vector of samples
+     * @param vector of label with same indexing as the samples
+     */
+    void add(const std::vector<Eigen::VectorXd> &samples, const std::vector<int>& lbl);
+
+    /**
+     * @brief append a mini-batch of samples associated with their labels.
+     * The closest component of each sample is computed in parallel against the model as it is before the batch,
+     * then each touched component receives its samples in one update of its statistics and of its parameters.
+     * The first sample of a class without component creates it. With a bounded training dataset (dataset_size_max > 0)
+     * the samples are appended one by one.
      * @param vector of samples
      * @param vector of label with same indexing as the samples
+     * @return index of the component in which each sample was added
      */
-    void append(const std::vector<Eigen::VectorXd> &samples,const std::vector<int>& lbl);
+    std::vector<int> append(const std::vector<Eigen::VectorXd> &samples,const std::vector<int>& lbl);
 
     /**
-     * @brief append a sample with its label and update the parameters of the model
+     * @brief append a sample with its label and update the parameters of the model.
+     * If the training dataset holds dataset_size_max samples (0 for no limit), a sample is first evicted according to the eviction policy :
+     * the oldest one, or a random one with the RESERVOIR policy, which also drops the new sample itself with probability 1 - dataset_size_max/(number of samples received).
+     * The evicted sample is removed from its component, whose statistics are downdated.
      * @param sample
      * @param label
-     * @return return the index of component in which the new sample was added.
+     * @return return the index of component in which the new sample was added, or of its closest component if it was dropped.
      */
     int append(const Eigen::VectorXd &samples,const int& lbl);
 
     /**
-     * @brief update the model according to the current dataset
+     * @brief update the model according to the current dataset. With auto publish the updated model is published (see publish).
      */
     void update();
 
+    /**
+     * @brief refine the components of each class with the expectation maximization algorithm, starting from the current model.
+     * Each iteration is one pass over the samples of the class : the E-step computes in parallel the soft sufficient statistics
+     * (sum of responsibilities, first and second moments) of every component, the M-step recomputes the weights, means and covariances from them.
+     * Stops when the relative increase of the loglikelihood of the class is below tolerance. The samples are then moved to the component
+     * of highest responsibility, and components left without samples are removed.
+     * The sufficient statistics of the components are set to the refined parameters (see Component::set_statistics_from_parameters),
+     * so they are kept by update_model and updated by the next samples, until a split or a merge of the component.
+     * @param maximum number of iterations per class
+     * @param tolerance on the relative increase of the loglikelihood
+     * @return total number of passes over the data
+     */
+    int refine(int max_iterations = 10, double tolerance = 1e-4);
+
+    /**
+     * @brief compile the current model into an immutable snapshot and make it the one returned by snapshot().
+     * The training thread keeps modifying its own model, the readers only see complete snapshots.
+     */
+    void publish();
+
+    /**
+     * @brief last published snapshot of the model. Safe to call from any thread while the model is trained :
+     * the pointer is loaded atomically and the snapshot is never modified, so a reader never waits for an update
+     * and never sees a half applied split or merge. The snapshot stays valid as long as the reader holds it.
+     * The atomic load and store of std::shared_ptr may use a lock of the standard library, only held while the pointer is copied.
+     * @return the snapshot, null if the model was never published
+     */
+    CompiledModel::Ptr snapshot() const {return std::atomic_load(&_snapshot);}
+
     /**
      * @brief update model in batch mode: by reevaluating all the component
      */
@@ -163,6 +233,18 @@ public:
      */
     void update_factors();
 
+    /**
+     * @brief compute an estimation of class membership for all the samples in the training dataset.
+     * Only the components changed since the last call are evaluated on the whole dataset (see DensityCache).
+     */
+    void _estimate_training_dataset();
+
+    void set_samples(Data samples){
+        Classifier::set_samples(samples);
+        _density_cache.clear();
+        _arrivals.clear();
+    }
+
     /**
      * @brief compute the confidence of classification for the sample X
      * @param a sample
@@ -170,6 +252,13 @@ public:
      */
     double confidence(const Eigen::VectorXd& X) const;
 
+    /**
+     * @brief compute the confidence of classification for a batch of samples, with one mahalanobis distance kernel call per component
+     * @param matrix of samples, one sample per column
+     * @param output confidences, one per sample, same values as confidence(X)
+     */
+    void confidence(const Eigen::MatrixXd& samples, Eigen::VectorXd& confidences) const;
+
     /**
      * @brief choice of the next sample among a set of samples based on the uncertainty and the confidence of the classifier
      * @param set of new unlabelled samples
@@ -190,6 +279,17 @@ public:
     int next_sample(const std::vector<std::pair<Eigen::VectorXd,std::vector<double>>> &samples,
                     Eigen::VectorXd& choice_dist_map, Eigen::VectorXd& filter);
 
+    /**
+     * @brief choice of the next sample among a pool of candidates, same choice as the other overloads but without estimating
+     * the candidates beforehand : their estimation, uncertainty and confidence are computed in a single pass over the components,
+     * by tiles of candidates with one mahalanobis distance kernel call per component.
+     * @param matrix of unlabelled candidates, one per column
+     * @param choice distribution map which represents the probability of choice the proposed samples
+     * @param number of candidates per tile
+     * @return index of the chosen sample
+     */
+    int next_sample(const Eigen::MatrixXd& candidates, Eigen::VectorXd& choice_dist_map, int tile_size = 256);
+
 
     /**
      * @brief estimate probability of membership in the class lbl of a set of unknown samples
@@ -208,9 +308,9 @@ public:
 
 
     /**
-     * @brief k nearst neighbor
-     * @param samples
-     * @param output
+     * @brief k nearest neighbors of center among the training samples, through the spatial index of the training dataset (see Data::knn)
+     * @param center
+     * @param output dataset in which the neighbors are added by increasing distance
      * @param k
      */
     void knn(const Eigen::VectorXd& center,Data& output, int k);
@@ -233,6 +333,13 @@ public:
         arch & _nbr_class;
         arch & _dimension;
         arch & _model;
+        int cov_type = _covariance_type;
+        if(v >= 1)
+            arch & cov_type;
+        else cov_type = Component::FULL; //archives of version 0 only hold FULL models
+        _covariance_type = static_cast<Component::covariance_type_t>(cov_type);
+        if(archive::is_loading::value)
+            _update_component_lists();
     }
 
     /**
@@ -256,8 +363,12 @@ public:
     double loglikelihood(int label);
 
     //** GETTERS & SETTERS
-    void set_dataset_size_max(int dsm){_dataset_size_max = dsm;}
+    void set_dataset_size_max(int dsm){_dataset_size_max = dsm; _arrivals.clear();}
     int get_dataset_size_max(){return _dataset_size_max;}
+    void set_eviction_policy(eviction_policy_t ep){_eviction_policy = ep; _arrivals.clear();}
+    void set_auto_publish(bool ap){_auto_publish = ap;}
+    bool get_auto_publish() const {return _auto_publish;}
+    eviction_policy_t get_eviction_policy() const {return _eviction_policy;}
     void set_update_mode(update_mode_t um){_update_mode = um;}
     void set_max_nb_components(int max_nb){_max_nb_components = max_nb;}
     void set_loglikelihood_driver(bool ll){_llhood_drive = ll;}
@@ -266,6 +377,10 @@ public:
     void use_uncertainty(bool u){_use_uncertainty = u;}
     bool get_use_confidence(){return _use_confidence;}
     bool get_use_uncertainty(){return _use_uncertainty;}
+    void set_covariance_type(Component::covariance_type_t ct){_covariance_type = ct;}
+    Component::covariance_type_t get_covariance_type() const {return _covariance_type;}
+    void set_sufficient_statistics(bool ss);
+    bool get_sufficient_statistics() const {return _sufficient_statistics;}
     //*/
 
     bool skip_bootstrap = false; /**< boolean attribute indicating if a bootstrap phase should be applied before choosing the next sample. During the bootstrap phase the choice is random. The phase is off 10 samples in the dataset**/
@@ -294,6 +409,68 @@ private:
      */
     bool _split(const Component::Ptr& comp);
 
+    /**
+     * @brief label of the class with the less samples in the training dataset, 1 if all the classes have the same size
+     */
+    int _least_represented_class() const;
+
+    /**
+     * @brief weight of choice of a candidate for next_sample
+     * @param estimation of membership of the candidate to the least represented class
+     * @param confidence of classification of the candidate
+     * @return weight in [0,1], high for uncertain and not confident candidates
+     */
+    double _choice_weight(double est, double c) const;
+
+    /**
+     * @brief draw a candidate with a probability proportional to its weight, by binary search in the prefix sums of the weights
+     * @param weights of the candidates
+     * @param filter of the candidates, 0 to exclude a candidate and 1 otherwise
+     * @param output choice distribution map : the weights normalised by the largest one and filtered
+     * @return index of the chosen candidate, uniform choice if all the filtered weights are zero
+     */
+    int _draw(const Eigen::VectorXd& weights, const Eigen::VectorXd& filter, Eigen::VectorXd& choice_dist_map);
+
+    /**
+     * @brief rebuild the component store and refresh the list of the components of the classes with at least 5 components used by confidence.
+     * Called after each structural change of the model : new component, split, merge, removal, update, loading.
+     */
+    void _update_component_lists();
+
+    /**
+     * @brief list the components of the classes with at least 5 components, in class order
+     * @param output list of components
+     */
+    void _list_consistent_components(std::vector<Component::Ptr>& components) const;
+
+    /**
+     * @brief check that the model was not accessed through model() and that the number of components of each class
+     * did not change since the last _update_component_lists
+     */
+    bool _consistent_components_valid() const;
+
+    /**
+     * @brief remove the training sample of index i from the training dataset and from the component which holds it.
+     * The statistics of the component are downdated, and the component is removed if it has no sample left.
+     * @param index of the sample in the training dataset
+     */
+    void _evict(int i);
+
+    /**
+     * @brief index in the training dataset of the oldest sample, which is removed from the tracking of the order of arrival.
+     * The evictions move the samples (see Data::erase) : the order of arrival is tracked for the OLDEST_FIRST policy,
+     * the current order of the training dataset is taken as order of arrival when the tracking starts.
+     */
+    int _pop_oldest_sample();
+
+    /**
+     * @brief closest component of sample among the components of class lbl with the mahalanobis distance, through the component index of the class
+     * @param sample
+     * @param label
+     * @return index of the closest component
+     */
+    int _nearest_component(const Eigen::VectorXd& sample, int lbl);
+
     /**
      * @brief update factors of the GMM corresponding to the class of label lbl
      * @param label
@@ -314,9 +491,17 @@ private:
 
     update_mode_t _update_mode = STOCHASTIC; /**<mode of update of CMM : Stochastic or Batch. Stochastic for online learning and Batch for offline*/
 
+    Component::covariance_type_t _covariance_type = Component::FULL; /**<structure of the covariance matrix of the new components : FULL, DIAGONAL or SPHERICAL*/
+    bool _sufficient_statistics = true; /**<if true the components are updated from running sufficient statistics in O(d^2), otherwise their parameters are recomputed from all their samples*/
+
     boost::random::mt19937 _gen;
 
     bool _llhood_drive = false;
+    DensityCache _density_cache; /**<densities of the training samples used by _estimate_training_dataset*/
+    ComponentStore _store; /**<flat registry of the components of _model*/
+    std::vector<Component::Ptr> _consistent_components; /**<components of the classes with at least 5 components, used by confidence*/
+    std::vector<size_t> _consistent_class_sizes; /**<number of components of each class when _consistent_components was listed*/
+    std::map<int,ComponentIndex> _component_index; /**<index of the components of each class used by append, rebuilt when the number of components changes and after each update*/
     bool _use_confidence = true;
     bool _use_uncertainty = true;
 
@@ -325,7 +510,49 @@ private:
 
     int _max_nb_components = 0;
 
-    int _dataset_size_max = 1000;
+    int _dataset_size_max = 0; /**<maximum number of training samples kept by append, 0 for no limit*/
+    eviction_policy_t _eviction_policy = OLDEST_FIRST; /**<choice of the sample removed when the training dataset is full*/
+    long _stream_size = 0; /**<number of samples received by append, used by the RESERVOIR policy*/
+    std::vector<long> _arrivals; /**<order of arrival of each training sample, used by the OLDEST_FIRST policy with a bounded training dataset*/
+    std::deque<int> _positions; /**<index in the training dataset of the samples kept by increasing order of arrival*/
+    long _oldest_arrival = 0; /**<order of arrival of the oldest training sample*/
+    CompiledModel::Ptr _snapshot; /**<last published snapshot of the model, only accessed through atomic loads and stores*/
+    bool _auto_publish = false; /**<if true the model is published at the end of each update*/
+
+    /**
+     * @brief The _em_statistics class is a helper class to compute the E-step of refine in parallel with parallel reduce algo of intel tbb.
+     * It accumulates for each component the sum of the responsibilities of the samples and their first and second moments
+     * centered on the current mean of the component.
+     */
+    class _em_statistics{
+    public:
+        _em_statistics(const std::vector<Component::Ptr>& components, const Eigen::MatrixXd& samples, std::vector<int>& assignments);
+
+#ifndef NO_PARALLEL
+        _em_statistics(const _em_statistics &em, tbb::split) :
+            _em_statistics(em._components,em._samples,em._assignments){}
+
+        void operator ()(const tbb::blocked_range<size_t>& r){
+            accumulate(r.begin(),r.end());
+        }
+        void join(const _em_statistics& em);
+#endif
+        /**
+         * @brief accumulate the statistics of the samples of index begin to end - 1
+         */
+        void accumulate(size_t begin, size_t end);
+        void compute();
+
+        Eigen::VectorXd weights; /**<sum of the responsibilities of each component*/
+        Eigen::MatrixXd first_moments; /**<sum of r*(x - mu) for each component, one per column*/
+        std::vector<Eigen::MatrixXd> second_moments; /**<sum of r*(x - mu)(x - mu)^T for each component, only the diagonal with a DIAGONAL or SPHERICAL covariance*/
+        double loglikelihood = 0;
+
+    private:
+        const std::vector<Component::Ptr>& _components;
+        const Eigen::MatrixXd& _samples;
+        std::vector<int>& _assignments; /**<component of highest responsibility of each sample*/
+    };
 
     /**
      * @brief The _score_calculator class is a helper class to compute the loglikelihood in parallel with parallel reduce algo of intel tbb.
@@ -356,4 +583,6 @@ private:
 };
 }
 
+BOOST_CLASS_VERSION(cmm::CollabMM, 1)
+
 #endif //CollabMM_HPP
@@ -6,41 +6,47 @@
 #endif
 
 #include <iostream>
+#include <algorithm>
 
-#include <map>
+#include <vector>
 #include <eigen3/Eigen/Core>
 
+#include "component_store.hpp"
+
 namespace cmm{
 
 template <class gmm>
 /**
- * @brief Helper class to estimate the prediction of CMM with parallel reduce algo of intel tbb
+ * @brief component store of a classifier of type GMM, or the store built in local if the model was modified through model() since its last update
+ * @param the classifier
+ * @param local store
+ * @return a valid store of the components of the classifier
+ */
+const ComponentStore& component_store(const gmm* model, ComponentStore& local){
+    if(model->component_store().is_valid())
+        return model->component_store();
+    local.build(model->model());
+    return local;
+}
+
+/**
+ * @brief Helper class to estimate the prediction of CMM with parallel reduce algo of intel tbb.
+ * The components and the sample are only referenced : the estimator must not outlive them.
  */
 class Estimator{
 public:
-    Estimator(const gmm* model, const Eigen::VectorXd& X, int lbl)
-        : _X(X), _current_lbl(lbl),_sum(0){
-        _model = new gmm(*model);
-    }
+    Estimator(const ComponentStore& store, const Eigen::VectorXd& X, int lbl)
+        : _components(store.begin(lbl)), _X(X), _sum(0){}
 
 
 #ifndef NO_PARALLEL
-    Estimator(const Estimator& est, tbb::split) : _model(est._model), _X(est._X), _current_lbl(est._current_lbl){
-        _sum = 0;
-    }
+    Estimator(const Estimator& est, tbb::split) : _components(est._components), _X(est._X), _sum(0){}
 
     void operator()(const tbb::blocked_range<size_t>& r){
-        double val;
         double sum = _sum;
-
-        Eigen::VectorXd X = _X;
-
-        for(size_t i=r.begin(); i != r.end(); ++i){
-            val = _model->model()[_current_lbl][i]->get_factor()*
-                    _model->model()[_current_lbl][i]->compute_multivariate_normal_dist(X);
-            sum += val;
-
-        }
+        for(size_t i=r.begin(); i != r.end(); ++i)
+            sum += _components[i]->get_factor()*
+                    _components[i]->compute_multivariate_normal_dist(_X);
         _sum = sum;
     }
 
@@ -49,13 +55,12 @@ public:
     }
 #endif
 
-    double get_sum(){return _sum;}
+    double get_sum() const {return _sum;}
 
 private:
-    gmm* _model;
+    const Component::Ptr* _components; /**<first component of the class*/
+    const Eigen::VectorXd& _X;
     double _sum;
-    int _current_lbl;
-    Eigen::VectorXd _X;
 };
 
 template<class gmm>
@@ -65,42 +70,74 @@ template<class gmm>
  * @param a sample
  * @return a vector containing the probability of membership to each class of sample X
  */
-std::vector<double> estimation(const gmm* model, Eigen::VectorXd X){
-    std::map<int,double> sum_map;
-    for(int i = 0; i < model->get_nbr_class(); i++){
-        sum_map[i] = 0;
-    }
-    std::vector<double> estimations;
+std::vector<double> estimation(const gmm* model, const Eigen::VectorXd& X){
+    int nbr_class = model->get_nbr_class();
+    std::vector<double> sums(nbr_class,0);
+    ComponentStore local;
+    const ComponentStore& store = component_store(model,local);
 
 #ifdef NO_PARALLEL
-    for(int lbl = 0; lbl < model->get_nbr_class(); lbl++)
-    {
-        double val;
-        for(const auto& comp : model->model().at(lbl))
-        {
-            val = comp->get_factor()*
-                    comp->compute_multivariate_normal_dist(X);
-            sum_map[lbl] += val;
-        }
-    }
+    for(int i = 0; i < store.size(); i++)
+        sums[store.label(i)] += store[i]->get_factor()*
+                store[i]->compute_multivariate_normal_dist(X);
 #else
-    tbb::parallel_for(tbb::blocked_range<size_t>(0,model->get_nbr_class()),
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,nbr_class),
                       [&](const tbb::blocked_range<size_t>& r){
         for(int lbl = r.begin(); lbl != r.end();lbl++){
-            Estimator<gmm> estimator(model,X,lbl);
-            tbb::parallel_reduce(tbb::blocked_range<size_t>(0,model->model().at(lbl).size()),estimator);
-            sum_map[lbl] = estimator.get_sum();
+            Estimator estimator(store,X,lbl);
+            tbb::parallel_reduce(tbb::blocked_range<size_t>(0,store.size(lbl)),estimator);
+            sums[lbl] = estimator.get_sum();
         }
     });
 #endif
 
     double sum_of_sums = 0;
-    for(const auto& sum : sum_map)
-        sum_of_sums += sum.second;
-    for(int lbl = 0; lbl < model->get_nbr_class(); lbl++)
-        estimations.push_back((1 + sum_map[lbl])/(model->get_nbr_class() + sum_of_sums));
+    for(const double& sum : sums)
+        sum_of_sums += sum;
+    std::vector<double> estimations(nbr_class);
+    for(int lbl = 0; lbl < nbr_class; lbl++)
+        estimations[lbl] = (1 + sums[lbl])/(nbr_class + sum_of_sums);
     return estimations;
 }
 
+template<class gmm>
+/**
+ * @brief estimation of the class of a batch of samples from a classifier of type GMM (either CMM or incremental CMM).
+ * The samples are processed by tiles of tile_size samples : each tile is evaluated against all the components while it is in cache.
+ * @param the classifier
+ * @param matrix of samples, one sample per column
+ * @param output matrix of probability of membership, one row per sample and one column per class
+ * @param number of samples per tile
+ */
+void estimation(const gmm* model, const Eigen::MatrixXd& X, Eigen::MatrixXd& estimations, int tile_size = 256){
+    int nbr_class = model->get_nbr_class();
+    estimations = Eigen::MatrixXd::Zero(X.cols(),nbr_class);
+    ComponentStore local;
+    const ComponentStore& store = component_store(model,local);
+
+    auto estimate_block = [&](size_t begin, size_t end){
+        Eigen::VectorXd densities;
+        for(size_t tile = begin; tile < end; tile += tile_size){
+            size_t size = std::min<size_t>(tile_size,end - tile);
+            auto sums = estimations.middleRows(tile,size);
+            for(int i = 0; i < store.size(); i++){
+                store[i]->compute_multivariate_normal_dist(X.middleCols(tile,size),densities);
+                sums.col(store.label(i)) += store[i]->get_factor()*densities;
+            }
+            Eigen::VectorXd sum_of_sums = sums.rowwise().sum();
+            sums = (sums.array() + 1).colwise()/(sum_of_sums.array() + nbr_class);
+        }
+    };
+
+#ifdef NO_PARALLEL
+    estimate_block(0,X.cols());
+#else
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,X.cols(),tile_size),
+                      [&](const tbb::blocked_range<size_t>& r){
+        estimate_block(r.begin(),r.end());
+    });
+#endif
+}
+
 }//cmm
 #endif //GMM_ESTIMATOR_HPP
@@ -5,9 +5,15 @@
 #include <iostream>
 #include <map>
 
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/shared_ptr.hpp>
+
 #include "classifier.hpp"
 #include "component.hpp"
 #include "gmm_estimator.hpp"
+#include "density_cache.hpp"
+#include "component_index.hpp"
 
 namespace  cmm {
 
@@ -20,6 +26,7 @@ public:
     typedef std::map<int, std::vector<Component::Ptr>> model_t;
 
     IncrementalCollabMM(){
+        _store.build(_model);
         _distance = [](const Eigen::VectorXd& s1,const Eigen::VectorXd& s2) -> double {
             return (s1 - s2).squaredNorm();
         };
@@ -29,6 +36,7 @@ public:
 
         for(int i = 0; i < nbr_class; i++)
             _model.emplace(i,std::vector<Component::Ptr>());
+        _store.build(_model);
 
         _distance = [](const Eigen::VectorXd& s1,const Eigen::VectorXd& s2) -> double {
             return (s1 - s2).squaredNorm();
@@ -37,12 +45,14 @@ public:
 
     IncrementalCollabMM(const model_t& model){
         _dimension = model.at(0)[0]->get_dimension();
+        _covariance_type = model.at(0)[0]->get_covariance_type();
         _nbr_class = model.size();
         for(const auto& comps : model){
             _model.emplace(comps.first,std::vector<Component::Ptr>());
             for(const auto& comp : comps.second)
                 _model[comps.first].push_back(Component::Ptr(new Component(*(comp))));
         }
+        _store.build(_model);
         srand(time(NULL));
 //        _gen.seed(rand());
         _distance = [](const Eigen::VectorXd& s1,const Eigen::VectorXd& s2) -> double {
@@ -51,8 +61,9 @@ public:
     }
 
     IncrementalCollabMM(const IncrementalCollabMM& igmm) :
-        Classifier(igmm),_model(igmm._model),
+        Classifier(igmm),_model(igmm._model),_store(igmm._store),_density_cache(igmm._density_cache),
     _last_index(igmm._last_index), _last_label(igmm._last_label),
+    _covariance_type(igmm._covariance_type),
     _alpha(igmm._alpha), _u(igmm._u), _beta(igmm._beta){}
 
 
@@ -63,8 +74,11 @@ public:
     }
 
     std::vector<double> compute_estimation(const Eigen::VectorXd &X) const;
-    model_t& model(){return _model;}
+    void compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const;
+    using Classifier::compute_estimation;
+    model_t& model(){_store.invalidate(); _component_index.clear(); return _model;}
     const model_t& model() const {return _model;}
+    const ComponentStore& component_store() const {return _store;}
 
     void new_component(const Eigen::VectorXd& sample, int label);
 
@@ -77,20 +91,52 @@ public:
     void update_factors();
     void _update_factors(int lbl);
 
+    /**
+     * @brief compute an estimation of class membership for all the samples in the training dataset.
+     * Only the components changed since the last call are evaluated on the whole dataset (see DensityCache).
+     */
+    void _estimate_training_dataset();
+
+    void set_samples(Data samples){
+        Classifier::set_samples(samples);
+        _density_cache.clear();
+    }
+
+    template <typename archive>
+    void serialize(archive& arch, const unsigned int v){
+        arch & _nbr_class;
+        arch & _dimension;
+        arch & _model;
+        int cov_type = _covariance_type;
+        if(v >= 1)
+            arch & cov_type;
+        else cov_type = Component::FULL; //archives of version 0 only hold FULL models
+        _covariance_type = static_cast<Component::covariance_type_t>(cov_type);
+        if(archive::is_loading::value)
+            _store.build(_model);
+    }
+
     void set_alpha(double a){_alpha = a;}
     void set_u(double u){_u = u;}
     void set_beta(double b){_beta = b;}
+    void set_covariance_type(Component::covariance_type_t ct){_covariance_type = ct;}
+    Component::covariance_type_t get_covariance_type() const {return _covariance_type;}
 
 private:
 
     bool _merge(const Component::Ptr& comp);
     bool _split(const Component::Ptr& comp);
+    int _nearest_component(const Eigen::VectorXd& sample, int lbl);
 
     model_t _model;
+    ComponentStore _store; /**<flat registry of the components of _model*/
+    DensityCache _density_cache; /**<densities of the training samples used by _estimate_training_dataset*/
+    std::map<int,ComponentIndex> _component_index; /**<index of the components of each class used by add, rebuilt when the number of components changes and after each update*/
 
     int _last_index = 0;
     int _last_label = 0;
 
+    Component::covariance_type_t _covariance_type = Component::FULL; /**<structure of the covariance matrix of the new components*/
 
     double _alpha; /**<factor split parameter*/
     double _u; /**<mean split parameter*/
@@ -99,4 +145,6 @@ private:
 
 } //cmm
 
+BOOST_CLASS_VERSION(cmm::IncrementalCollabMM, 1)
+
 #endif //INCR_GMM_HPP
@@ -0,0 +1,123 @@
+#ifndef KDTREE_HPP
+#define KDTREE_HPP
+
+#include <vector>
+#include <queue>
+#include <eigen3/Eigen/Core>
+
+namespace cmm {
+
+/**
+ * @brief The KDTree class
+ * Balanced kd-tree over a set of points for exact nearest neighbor queries with the squared euclidean distance.
+ * The points are copied in a contiguous matrix, one point per column, and are referred by their index in the input set.
+ * Points can be inserted after the build : they are referred by their order of insertion after the initial points.
+ * Points can be removed : the last point then takes the index of the removed one, as with a swap with the last element of a vector.
+ * The tree is kept balanced by rebuilding the highest subtree in which one child holds more than 3/4 of the points (scapegoat).
+ */
+class KDTree{
+public:
+
+    KDTree(){}
+
+    /**
+     * @brief build the tree over a set of points
+     * @param points
+     * @param maximum number of points in a leaf
+     */
+    KDTree(const std::vector<Eigen::VectorXd>& points, int leaf_size = 10){
+        build(points,leaf_size);
+    }
+
+    /**
+     * @brief build the tree over a set of points
+     * @param points, one per column
+     * @param maximum number of points in a leaf
+     */
+    KDTree(const Eigen::Ref<const Eigen::MatrixXd>& points, int leaf_size = 10){
+        build(points,leaf_size);
+    }
+
+    /**
+     * @brief (re)build the tree over a set of points in O(n log n)
+     * @param points
+     * @param maximum number of points in a leaf
+     */
+    void build(const std::vector<Eigen::VectorXd>& points, int leaf_size = 10);
+
+    /**
+     * @brief (re)build the tree over a set of points in O(n log n)
+     * @param points, one per column
+     * @param maximum number of points in a leaf
+     */
+    void build(const Eigen::Ref<const Eigen::MatrixXd>& points, int leaf_size = 10);
+
+    /**
+     * @brief search the nearest point of query. Among equidistant points the one with the smallest index is returned.
+     * @param query
+     * @param output squared distance between query and its nearest point
+     * @param index of a point to ignore, for instance the query itself. -1 to consider all the points.
+     * @return index of the nearest point, -1 if there is no candidate
+     */
+    int nearest(const Eigen::VectorXd& query, double& sq_dist, int exclude = -1) const;
+
+    /**
+     * @brief search the k nearest points of query. Among equidistant points the ones with the smallest indexes come first.
+     * @param query
+     * @param number of neighbors
+     * @param output indexes of the min(k,size()) nearest points by increasing distance
+     * @param output squared distances between query and these points
+     */
+    void knn(const Eigen::VectorXd& query, int k, std::vector<int>& indexes, std::vector<double>& sq_dists) const;
+
+    /**
+     * @brief insert a point in the tree in amortized O(log^2 n)
+     * @param point
+     * @return index of the point
+     */
+    int insert(const Eigen::VectorXd& point);
+
+    /**
+     * @brief remove the point of index ind in O(log n). The last point takes the index ind.
+     * @param index of the point
+     */
+    void remove(int ind);
+
+    /**
+     * @brief remove all the points
+     */
+    void clear();
+
+    size_t size() const {return _size;}
+
+private:
+    typedef std::priority_queue<std::pair<double,int>> _heap_t; /**<candidates of a knn query, the farthest on top*/
+
+    struct _node_t{
+        int left = -1;
+        int right = -1;
+        int axis = 0;
+        double split = 0;
+        int size = 0; /**<number of points in the subtree*/
+        std::vector<int> indexes; /**<points of a leaf*/
+    };
+
+    int _new_node();
+    int _build(std::vector<int>& indexes, int begin, int end);
+    void _rebuild(int node);
+    void _collect(int node, std::vector<int>& indexes);
+    bool _replace(int node, const Eigen::VectorXd& point, int ind, int new_ind, bool prune);
+    void _nearest(int node, const Eigen::VectorXd& query, int exclude, int& best, double& best_dist) const;
+    void _knn(int node, const Eigen::VectorXd& query, int k, _heap_t& heap) const;
+
+    Eigen::MatrixXd _points; /**<the points, one per column. Columns past _size are reserved for insertions*/
+    int _size = 0; /**<number of points*/
+    std::vector<_node_t> _nodes;
+    std::vector<int> _free_nodes; /**<nodes released by a rebuild, reused by the next ones*/
+    int _root = -1;
+    int _leaf_size = 10;
+};
+
+}
+
+#endif //KDTREE_HPP
@@ -0,0 +1,257 @@
+#ifndef SCALAR_MODEL_HPP
+#define SCALAR_MODEL_HPP
+
+#ifndef NO_PARALLEL
+#include <tbb/tbb.h>
+#endif
+
+#include <cmath>
+#include <cassert>
+#include <vector>
+#include <type_traits>
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/StdVector>
+#include <boost/shared_ptr.hpp>
+
+#include "component.hpp"
+
+namespace cmm {
+
+/**
+ * @brief The InferenceModel class
+ * Common interface of the read-only models used for prediction.
+ */
+class InferenceModel{
+public:
+    typedef boost::shared_ptr<InferenceModel> Ptr;
+
+    virtual ~InferenceModel(){}
+
+    virtual std::vector<double> compute_estimation(const Eigen::VectorXd& sample) const = 0;
+    virtual void compute_estimation(const Eigen::VectorXd& sample, Eigen::VectorXd& estimation) const = 0;
+    virtual void compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const = 0;
+
+    virtual int get_dimension() const = 0;
+    virtual int get_nbr_class() const = 0;
+};
+
+template <typename Scalar = float, int Dim = Eigen::Dynamic>
+/**
+ * @brief The ScalarModel class
+ * Read-only copy of a trained CMM (CollabMM or IncrementalCollabMM) in which the means and the covariance factors
+ * are stored with the scalar type Scalar. With Scalar = float the Mahalanobis distances are computed with twice the SIMD width
+ * and half the memory bandwidth. The densities and the class sums are accumulated in double.
+ * If Dim is not Eigen::Dynamic the dimension is fixed at compile time : the single sample estimation does not allocate
+ * and the small matrix operations are fully unrolled. Use make_inference_model to pick Dim at runtime.
+ * The estimations follow the same formula as cmm::estimation.
+ */
+class ScalarModel : public InferenceModel{
+public:
+
+    typedef Eigen::Matrix<Scalar,Dim,1> vector_t;
+    typedef Eigen::Matrix<Scalar,Dim,Dim> matrix_t;
+    typedef Eigen::Matrix<Scalar,Dim,Eigen::Dynamic> samples_t;
+
+    ScalarModel(){}
+
+    /**
+     * @brief convert a trained model
+     * @param a CollabMM or an IncrementalCollabMM
+     */
+    template <class gmm>
+    ScalarModel(const gmm& model) :
+        _dimension(model.get_dimension()), _nbr_class(model.get_nbr_class()){
+        assert(Dim == Eigen::Dynamic || Dim == _dimension);
+        _model.resize(_nbr_class);
+        for(int lbl = 0; lbl < _nbr_class; lbl++){
+            if(model.model().find(lbl) == model.model().end())
+                continue;
+            for(const auto& comp : model.model().at(lbl))
+                _model[lbl].push_back(_convert(*comp));
+        }
+    }
+
+    /**
+     * @brief compute the estimation for a sample
+     * @param sample
+     * @return a vector of probability membership to each class
+     */
+    std::vector<double> compute_estimation(const Eigen::VectorXd& sample) const {
+        Eigen::VectorXd estimation(_nbr_class);
+        compute_estimation(sample,estimation);
+        return std::vector<double>(estimation.data(),estimation.data() + _nbr_class);
+    }
+
+    /**
+     * @brief compute the estimation for a sample without allocation if estimation has already the right size
+     * @param sample
+     * @param output probability membership to each class
+     */
+    void compute_estimation(const Eigen::VectorXd& sample, Eigen::VectorXd& estimation) const {
+        estimation.setZero(_nbr_class);
+        vector_t X = sample.template cast<Scalar>();
+        vector_t diff;
+        for(int lbl = 0; lbl < _nbr_class; lbl++){
+            for(const auto& comp : _model[lbl]){
+                diff = X - comp.mu;
+                double distance;
+                if(comp.diagonal)
+                    distance = diff.cwiseAbs2().dot(comp.inverse_variances);
+                else if(comp.cholesky){
+                    _factors[comp.factor].template triangularView<Eigen::Lower>().solveInPlace(diff);
+                    distance = diff.squaredNorm();
+                }
+                else distance = diff.dot(_factors[comp.factor]*diff);
+                estimation(lbl) += comp.weight*_density(comp,distance);
+            }
+        }
+        double sum_of_sums = estimation.sum();
+        for(int lbl = 0; lbl < _nbr_class; lbl++)
+            estimation(lbl) = (1 + estimation(lbl))/(_nbr_class + sum_of_sums);
+    }
+
+    /**
+     * @brief compute the estimation for a batch of samples
+     * @param matrix of samples, one sample per column
+     * @param output matrix of probability membership, one row per sample and one column per class
+     */
+    void compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const {
+        samples_t buffer;
+        const Eigen::Map<const samples_t> X = _samples_view(samples,buffer,std::is_same<Scalar,double>());
+        Eigen::MatrixXd sums = Eigen::MatrixXd::Zero(X.cols(),_nbr_class);
+
+        auto estimate_block = [&](size_t begin, size_t end){
+            Eigen::Matrix<Scalar,Eigen::Dynamic,1> distances;
+            for(int lbl = 0; lbl < _nbr_class; lbl++){
+                for(const auto& comp : _model[lbl]){
+                    _distance(comp,X.middleCols(begin,end-begin),distances);
+                    for(size_t i = 0; i < end - begin; i++)
+                        sums(begin + i,lbl) += comp.weight*_density(comp,distances(i));
+                }
+            }
+        };
+
+#ifdef NO_PARALLEL
+        estimate_block(0,X.cols());
+#else
+        tbb::parallel_for(tbb::blocked_range<size_t>(0,X.cols()),
+                          [&](const tbb::blocked_range<size_t>& r){
+            estimate_block(r.begin(),r.end());
+        });
+#endif
+
+        estimations.resize(X.cols(),_nbr_class);
+        for(int i = 0; i < X.cols(); i++){
+            double sum_of_sums = sums.row(i).sum();
+            estimations.row(i) = (1 + sums.row(i).array())/(_nbr_class + sum_of_sums);
+        }
+    }
+
+    int get_dimension() const {return _dimension;}
+    int get_nbr_class() const {return _nbr_class;}
+
+private:
+
+    /**
+     * @brief a component reduced to what is needed for the estimation
+     */
+    struct _component_t{
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        vector_t mu;
+        int factor; /**<index in _factors of the Cholesky factor L, or of the pseudo inverse if singular. -1 with a diagonal covariance*/
+        vector_t inverse_variances; /**<only used with diagonal covariances*/
+        bool cholesky;
+        bool diagonal;
+        double log_determinant;
+        double weight;
+    };
+
+    _component_t _convert(const Component& c){
+        _component_t comp;
+        comp.mu = c.get_mu().template cast<Scalar>();
+        comp.log_determinant = c.get_log_determinant();
+        comp.weight = c.get_factor();
+        comp.diagonal = c.get_covariance_type() != Component::FULL;
+        comp.cholesky = !comp.diagonal && !c.is_singular();
+        comp.factor = comp.diagonal ? -1 : _factors.size();
+        Eigen::MatrixXd inverse;
+        double determinant = 1.;
+        if(comp.cholesky)
+            _factors.push_back(c.get_cholesky().template cast<Scalar>());
+        else{
+            c.covariance_inverse(inverse,determinant);
+            if(comp.diagonal)
+                comp.inverse_variances = inverse.diagonal().template cast<Scalar>();
+            else _factors.push_back(inverse.template cast<Scalar>());
+        }
+        return comp;
+    }
+
+    /**
+     * @brief the samples with the scalar type Scalar : converted into buffer, or mapped without copy if Scalar is double
+     */
+    static Eigen::Map<const samples_t> _samples_view(const Eigen::MatrixXd& samples, samples_t& buffer, std::false_type){
+        buffer = samples.template cast<Scalar>();
+        return Eigen::Map<const samples_t>(buffer.data(),buffer.rows(),buffer.cols());
+    }
+    static Eigen::Map<const samples_t> _samples_view(const Eigen::MatrixXd& samples, samples_t&, std::true_type){
+        return Eigen::Map<const samples_t>(samples.data(),samples.rows(),samples.cols());
+    }
+
+    /**
+     * @brief mahalanobis distance of a block of samples to a component
+     */
+    template <typename block_t>
+    void _distance(const _component_t& comp, const block_t& X, Eigen::Matrix<Scalar,Eigen::Dynamic,1>& distances) const {
+        samples_t diff = X.colwise() - comp.mu;
+        if(comp.diagonal)
+            distances = diff.cwiseAbs2().transpose()*comp.inverse_variances;
+        else if(comp.cholesky){
+            _factors[comp.factor].template triangularView<Eigen::Lower>().solveInPlace(diff);
+            distances = diff.colwise().squaredNorm().transpose();
+        }
+        else distances = (diff.array()*(_factors[comp.factor]*diff).array()).colwise().sum().transpose();
+    }
+
+    /**
+     * @brief density of a component from the mahalanobis distance, same guards as Component::compute_multivariate_normal_dist
+     */
+    double _density(const _component_t& comp, double distance) const {
+        double exp_arg = -1./2.*distance;
+        if(exp_arg > 0) //the covariance matrix is not positive definite
+            return 0;
+        double res = std::exp(exp_arg - comp.log_determinant - std::log(2*PI));
+        return res == res ? res : 0;
+    }
+
+    int _dimension = 0;
+    int _nbr_class = 0;
+    std::vector<std::vector<_component_t,Eigen::aligned_allocator<_component_t>>> _model; /**<the components of each class*/
+    std::vector<matrix_t,Eigen::aligned_allocator<matrix_t>> _factors; /**<covariance factors of the components with a full covariance*/
+};
+
+template <typename Scalar, class gmm>
+/**
+ * @brief build the inference model of a trained CMM with a dimension fixed at compile time for the low dimensional models (1 to 8),
+ * otherwise with a dynamic dimension.
+ * @param a CollabMM or an IncrementalCollabMM
+ * @return pointer to the inference model
+ */
+InferenceModel::Ptr make_inference_model(const gmm& model){
+    switch(model.get_dimension()){
+    case 1: return InferenceModel::Ptr(new ScalarModel<Scalar,1>(model));
+    case 2: return InferenceModel::Ptr(new ScalarModel<Scalar,2>(model));
+    case 3: return InferenceModel::Ptr(new ScalarModel<Scalar,3>(model));
+    case 4: return InferenceModel::Ptr(new ScalarModel<Scalar,4>(model));
+    case 5: return InferenceModel::Ptr(new ScalarModel<Scalar,5>(model));
+    case 6: return InferenceModel::Ptr(new ScalarModel<Scalar,6>(model));
+    case 7: return InferenceModel::Ptr(new ScalarModel<Scalar,7>(model));
+    case 8: return InferenceModel::Ptr(new ScalarModel<Scalar,8>(model));
+    default: return InferenceModel::Ptr(new ScalarModel<Scalar>(model));
+    }
+}
+
+}
+
+#endif //SCALAR_MODEL_HPP
@@ -109,14 +109,18 @@ public:
         int upper_bound = _g_count + 10*_batch_size;
         if(_g_count + 10*_batch_size > _train_data.size())
             upper_bound -= upper_bound - _train_data.size();
-        boost::random::uniform_int_distribution<> dist(_g_count,upper_bound);
+        boost::random::uniform_int_distribution<> dist(_g_count,upper_bound - 1);
         std::chrono::system_clock::time_point timer;
         timer  = std::chrono::system_clock::now();
 
+        std::vector<Eigen::VectorXd> samples(_batch_size);
+        std::vector<int> labels(_batch_size);
         for(int i = 0; i < _batch_size; i++){
             n = dist(_gen);
-            _classifier.add(_train_data[n].second,_train_data[n].first);
+            samples[i] = _train_data[n].second;
+            labels[i] = _train_data[n].first;
         }
+        _classifier.add(samples,labels);
         std::cout << "add step, time spent : "
                   << std::chrono::duration_cast<std::chrono::milliseconds>(
                          std::chrono::system_clock::now() - timer).count() << std::endl;
@@ -126,7 +130,7 @@ public:
                   << std::chrono::duration_cast<std::chrono::milliseconds>(
                          std::chrono::system_clock::now() - timer).count() << std::endl;
         _g_count += _batch_size;
-        if(_g_count > _train_data.size())
+        if(_g_count >= _train_data.size())
             _g_count = 0;
     }
 
@@ -136,21 +140,15 @@ public:
      * @return the global error
      */
     double test(std::vector<double> &errors){
-        double error = 0;
-        errors.resize(_classifier.get_nbr_class(),0);
-#ifdef NO_PARALLEL
-        double est;
+        double error = 0, est;
+        errors.assign(_classifier.get_nbr_class(),0);
+        Eigen::MatrixXd estimations;
+        _classifier.compute_estimation(_test_data.get_samples_matrix(),estimations);
         for(int i = 0; i < _test_data.size(); i++){
-            est =  _classifier.compute_estimation(_test_data[i].second)[_test_data[i].first];
+            est = estimations(i,_test_data[i].first);
             error += 1 - est;
-            errors[_test_data[i].first]+=1-est;
+            errors[_test_data[i].first] += 1 - est;
         }
-#else
-        _error_computer ec(_classifier,_test_data);
-        tbb::parallel_reduce(tbb::blocked_range<size_t>(0,_test_data.size()),ec);
-        error = ec.get_error();
-        errors = ec.get_errors();
-#endif
         error = error/(double) _test_data.size();
         for(int i = 0; i < errors.size(); i++)
             errors[i] = errors[i]/(double)_test_data.get_data(i).size();
@@ -177,53 +175,6 @@ private:
     int _g_count = 0;
 
     boost::random::mt19937 _gen;
-
-    /**
-     * @brief Helper class to compute the error in parallel using parallel reduce algo of intel tbb.
-     */
-    class _error_computer{
-    public:
-        _error_computer(Classifier& model, Data samples) :
-            _model(model), _samples(samples), _sum(0){
-            _sums.resize(_model.get_nbr_class(),0);
-        }
-
-#ifndef NO_PARALLEL
-        _error_computer(const _error_computer &sc, tbb::split) :
-            _model(sc._model), _samples(sc._samples), _sum(0){
-            _sums.resize(_model.get_nbr_class(),0);
-        }
-
-        void operator ()(const tbb::blocked_range<size_t>& r){
-            double sum = _sum;
-            double est;
-            std::vector<double> sums = _sums;
-            for(int i = r.begin(); i != r.end(); i++){
-                est =  _model.compute_estimation(_samples[i].second)[_samples[i].first];
-                sum += 1 - est;
-                sums[_samples[i].first] = 1 - est;
-            }
-            _sum = sum;
-            _sums = sums;
-        }
-
-        void join(const _error_computer& sc){
-            _sum += sc._sum;
-            for(int i = 0; i < _sums.size(); i++)
-                _sums[i] += sc._sums[i];
-        }
-#endif
-
-        double get_error(){return _sum;}
-        std::vector<double> get_errors(){return _sums;}
-
-    private:
-        Classifier _model;
-        double _sum;
-        std::vector<double> _sums;
-        Data _samples;
-    };
-
 };
 } // cmm
 
@@ -0,0 +1,182 @@
+#include "cmm/compiled_model.hpp"
+#include <cmath>
+#include <limits>
+
+#ifndef NO_PARALLEL
+#include <tbb/tbb.h>
+#endif
+
+using namespace cmm;
+
+void CompiledModel::_compile(const model_t& model, int dimension, int nbr_class){
+    _dimension = dimension;
+    _nbr_class = nbr_class;
+
+    _offsets.assign(_nbr_class + 1,0);
+    for(int lbl = 0; lbl < _nbr_class; lbl++){
+        int size = model.find(lbl) == model.end() ? 0 : model.at(lbl).size();
+        _offsets[lbl + 1] = _offsets[lbl] + size;
+    }
+    int nbr_comp = _offsets[_nbr_class];
+
+    //only the components with a full covariance have a factor
+    _factor_indexes.assign(nbr_comp,-1);
+    int nbr_factors = 0;
+    for(int lbl = 0; lbl < _nbr_class; lbl++)
+        for(int k = _offsets[lbl]; k < _offsets[lbl + 1]; k++)
+            if(model.at(lbl)[k - _offsets[lbl]]->get_covariance_type() == Component::FULL)
+                _factor_indexes[k] = nbr_factors++;
+
+    _means.resize(_dimension,nbr_comp);
+    _factors.resize(_dimension,nbr_factors*_dimension);
+    _inverse_variances = Eigen::MatrixXd::Zero(_dimension,nbr_comp);
+    _log_normalizations.resize(nbr_comp);
+    _log_coefficients.resize(nbr_comp);
+    _peak_densities.resize(nbr_comp);
+    _factor_types.resize(nbr_comp);
+    _consistent.resize(nbr_comp);
+
+    Eigen::MatrixXd inverse;
+    double determinant;
+    for(int lbl = 0; lbl < _nbr_class; lbl++){
+        for(int k = _offsets[lbl]; k < _offsets[lbl + 1]; k++){
+            const Component& comp = *model.at(lbl)[k - _offsets[lbl]];
+            _means.col(k) = comp.get_mu();
+            _log_normalizations(k) = -comp.get_log_determinant() - std::log(2*PI);
+            _log_coefficients(k) = std::log(comp.get_factor()) + _log_normalizations(k);
+            _peak_densities(k) = _density(0,_log_normalizations(k));
+            _consistent[k] = _offsets[lbl + 1] - _offsets[lbl] >= 5;
+
+            if(comp.get_covariance_type() != Component::FULL){
+                _factor_types[k] = DIAGONAL;
+                comp.covariance_inverse(inverse,determinant);
+                _inverse_variances.col(k) = inverse.diagonal();
+            }
+            else if(comp.is_singular()){
+                _factor_types[k] = PSEUDO_INVERSE;
+                comp.covariance_inverse(inverse,determinant);
+                _factors.middleCols(_factor_indexes[k]*_dimension,_dimension) = inverse;
+            }
+            else{
+                _factor_types[k] = CHOLESKY;
+                _factors.middleCols(_factor_indexes[k]*_dimension,_dimension) = comp.get_cholesky();
+            }
+        }
+    }
+}
+
+double CompiledModel::_distance(const Eigen::VectorXd& sample, int k, Eigen::VectorXd& diff) const {
+    diff = sample - _means.col(k);
+    switch(_factor_types[k]){
+    case DIAGONAL:
+        return diff.cwiseAbs2().dot(_inverse_variances.col(k));
+    case PSEUDO_INVERSE:
+        return diff.dot(_factor(k)*diff);
+    default:
+        _factor(k).triangularView<Eigen::Lower>().solveInPlace(diff);
+        return diff.squaredNorm();
+    }
+}
+
+void CompiledModel::_distances(const Eigen::Ref<const Eigen::MatrixXd>& samples, int k, Eigen::VectorXd& distances) const {
+    Eigen::MatrixXd diff = samples.colwise() - _means.col(k);
+    switch(_factor_types[k]){
+    case DIAGONAL:
+        distances = diff.cwiseAbs2().transpose()*_inverse_variances.col(k);
+        break;
+    case PSEUDO_INVERSE:
+        distances = (diff.array()*(_factor(k)*diff).array()).colwise().sum().transpose();
+        break;
+    default:
+        _factor(k).triangularView<Eigen::Lower>().solveInPlace(diff);
+        distances = diff.colwise().squaredNorm().transpose();
+    }
+}
+
+double CompiledModel::_density(double distance, double log_coefficient) const {
+    double exp_arg = -1./2.*distance;
+    if(exp_arg > 0) //the covariance matrix is not positive definite
+        return 0;
+    double res = std::exp(exp_arg + log_coefficient);
+    return res == res ? res : 0;
+}
+
+std::vector<double> CompiledModel::compute_estimation(const Eigen::VectorXd& sample) const {
+    Eigen::VectorXd estimation;
+    compute_estimation(sample,estimation);
+    return std::vector<double>(estimation.data(),estimation.data() + _nbr_class);
+}
+
+void CompiledModel::compute_estimation(const Eigen::VectorXd& sample, Eigen::VectorXd& estimation) const {
+    estimation.setZero(_nbr_class);
+    Eigen::VectorXd diff(_dimension);
+    for(int lbl = 0; lbl < _nbr_class; lbl++)
+        for(int k = _offsets[lbl]; k < _offsets[lbl + 1]; k++)
+            estimation(lbl) += _density(_distance(sample,k,diff),_log_coefficients(k));
+
+    double sum_of_sums = estimation.sum();
+    for(int lbl = 0; lbl < _nbr_class; lbl++)
+        estimation(lbl) = (1 + estimation(lbl))/(_nbr_class + sum_of_sums);
+}
+
+void CompiledModel::compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const {
+    Eigen::MatrixXd sums = Eigen::MatrixXd::Zero(samples.cols(),_nbr_class);
+
+    auto estimate_block = [&](size_t begin, size_t end){
+        Eigen::VectorXd distances;
+        for(int lbl = 0; lbl < _nbr_class; lbl++){
+            for(int k = _offsets[lbl]; k < _offsets[lbl + 1]; k++){
+                _distances(samples.middleCols(begin,end-begin),k,distances);
+                for(size_t i = 0; i < end - begin; i++)
+                    sums(begin + i,lbl) += _density(distances(i),_log_coefficients(k));
+            }
+        }
+    };
+
+#ifdef NO_PARALLEL
+    estimate_block(0,samples.cols());
+#else
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,samples.cols()),
+                      [&](const tbb::blocked_range<size_t>& r){
+        estimate_block(r.begin(),r.end());
+    });
+#endif
+
+    estimations.resize(samples.cols(),_nbr_class);
+    for(int i = 0; i < samples.cols(); i++){
+        double sum_of_sums = sums.row(i).sum();
+        estimations.row(i) = (1 + sums.row(i).array())/(_nbr_class + sum_of_sums);
+    }
+}
+
+double CompiledModel::predict(const Data& data, Eigen::MatrixXd& results) const {
+    compute_estimation(data.get_samples_matrix(),results);
+
+    double error = 0;
+    for(size_t i = 0; i < data.size(); i++){
+        error = error + 1 - results(i,data[i].first);
+    }
+    return error/(double)data.size();
+}
+
+double CompiledModel::confidence(const Eigen::VectorXd& sample) const {
+    //* Look for the closest consistent component of sample
+    int closest = -1;
+    double min_dist = std::numeric_limits<double>::infinity();
+    Eigen::VectorXd diff(_dimension);
+    for(int k = 0; k < _means.cols(); k++){
+        if(!_consistent[k])
+            continue;
+        double dist = _distance(sample,k,diff);
+        if(closest < 0 || dist < min_dist){
+            min_dist = dist;
+            closest = k;
+        }
+    }
+    //*/
+
+    if(closest < 0)
+        return 0;
+
+    return _density(min_dist,_log_normalizations(closest))/_peak_densities(closest);
+}
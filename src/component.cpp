@@ -3,6 +3,12 @@
 #include <iostream>
 #include <boost/math/distributions/fisher_f.hpp>
 #include <boost/random.hpp>
+#include <queue>
+#include <tuple>
+#include <functional>
+#include <limits>
+#include <algorithm>
+#include "cmm/kdtree.hpp"
 
 #define COEF 1.
 
@@ -10,25 +16,33 @@ using namespace cmm;
 
 
 double Component::_alpha = 0.25;
+std::atomic<unsigned long> Component::_stamp_counter(0);
+std::atomic<unsigned long> Component::_id_counter(0);
 
-void Component::update_parameters(){
-    if(_samples.size() <= 4){
+void Component::_reset_covariance(){
+    if(_covariance_type == FULL)
         _covariance = Eigen::MatrixXd::Identity(_dimension,_dimension)*COEF;
-        _mu = _samples[0];
-        _size = _samples.size();
+    else _variances = Eigen::VectorXd::Constant(_dimension,COEF);
+}
+
+void Component::update_parameters(){
+    _fitted = false;
+    if(_nb_samples == 0) //no sample to compute the parameters from, they are kept
+        return;
+    if(_nb_samples <= 4){
+        _reset_covariance();
+        _mu = _samples.col(0);
+        _size = _nb_samples;
+        _update_factorization();
         return;
     }
-    _check_samples();
-
-
-    Eigen::MatrixXd m_sum = Eigen::MatrixXd::Zero(_dimension,_dimension);
-    Eigen::VectorXd v_sum = Eigen::VectorXd::Zero(_dimension);
 
-    for(int i = 0 ; i < _samples.size(); i++){
-        v_sum += _samples[i];
+    if(!_sufficient_statistics){ //full recompute from the samples
+        _check_samples();
+        _rebuild_statistics();
     }
 
-    _mu = 1./_samples.size()*v_sum;
+    _mu = _stat_mean;
 
     for(int i = 0; i < _mu.rows(); i++)
         if(_mu(i) != _mu(i))
@@ -36,58 +50,400 @@ void Component::update_parameters(){
 
 
 
-    for(const auto& sample : _samples){
-        m_sum += (sample - _mu)*(sample - _mu).transpose();
+    if(_covariance_type == FULL){
+        if(_stat_scatter.squaredNorm() < 1e-4)
+            _reset_covariance();
+        else{
+            _covariance = 1./(_stat_count-1)*_stat_scatter*COEF;
+            _fitted = true;
+        }
+    }
+    else{
+        if(_stat_scatter_diag.squaredNorm() < 1e-4)
+            _reset_covariance();
+        else{
+            _variances = 1./(_stat_count-1)*_stat_scatter_diag*COEF;
+            _fitted = true;
+        }
+        if(_covariance_type == SPHERICAL)
+            _variances.setConstant(_variances.mean());
     }
 
-    if((m_sum-Eigen::MatrixXd::Zero(_dimension,_dimension)).squaredNorm() < 1e-4)
-        _covariance = Eigen::MatrixXd::Identity(_dimension,_dimension)*COEF;
-    else
-        _covariance = 1./(_samples.size()-1)*m_sum*COEF;
+    _size = _nb_samples;
+    _update_factorization();
+}
+
+
+void Component::add(Eigen::VectorXd sample){
+    if(sample.rows() == 0) //artefakt sample
+        return;
+    for(int i = 0; i < sample.rows(); i++)
+        if(sample(i) != sample(i))
+            sample(i) = 0;
+    _reserve(_nb_samples + 1);
+    _samples.col(_nb_samples++) = sample;
+    _size++;
+    _fitted = false;
+    if(_sufficient_statistics)
+        _accumulate(sample);
+}
+
+void Component::add_samples(const Eigen::Ref<const Eigen::MatrixXd>& samples){
+    int n = samples.cols();
+    if(n == 0 || samples.rows() == 0)
+        return;
+    _reserve(_nb_samples + n);
+    auto block = _samples.middleCols(_nb_samples,n);
+    block = samples.unaryExpr([](double v) -> double {return v != v ? 0 : v;});
+    _nb_samples += n;
+    _size += n;
+    _fitted = false;
+    if(!_sufficient_statistics)
+        return;
+
+    Eigen::VectorXd mean = 1./n*block.rowwise().sum();
+    Eigen::MatrixXd centered = block.colwise() - mean;
+    Eigen::MatrixXd scatter;
+    Eigen::VectorXd scatter_diag;
+    if(_covariance_type == FULL)
+        scatter.noalias() = centered*centered.transpose();
+    else scatter_diag = centered.cwiseAbs2().rowwise().sum();
+    _accumulate(n,mean,scatter,scatter_diag);
+}
+
+void Component::_reserve(int n){
+    if(_samples.rows() == _dimension && _samples.cols() >= n)
+        return;
+    int capacity = std::max(n,2*(int)_samples.cols());
+    _samples.conservativeResize(_dimension,std::max(capacity,4));
+}
+
+void Component::clear(){
+    _nb_samples = 0;
+    _fitted = false;
+    _rebuild_statistics();
+}
+
+void Component::set_sufficient_statistics(bool ss){
+    _sufficient_statistics = ss;
+    if(_sufficient_statistics)
+        _rebuild_statistics();
+}
 
-    _size = _samples.size();
+void Component::_accumulate(const Eigen::VectorXd& sample){
+    if(_stat_count == 0){
+        _stat_mean = Eigen::VectorXd::Zero(_dimension);
+        if(_covariance_type == FULL)
+            _stat_scatter = Eigen::MatrixXd::Zero(_dimension,_dimension);
+        else _stat_scatter_diag = Eigen::VectorXd::Zero(_dimension);
+    }
 
+    _stat_count++;
+    Eigen::VectorXd delta = sample - _stat_mean;
+    _stat_mean += delta/_stat_count;
+    double coef = (_stat_count - 1.)/_stat_count;
+    if(_covariance_type == FULL)
+        _stat_scatter.noalias() += coef*delta*delta.transpose();
+    else _stat_scatter_diag += coef*delta.cwiseAbs2();
 }
 
+void Component::_accumulate(const Component& c){
+    if(c._stat_count == 0)
+        return;
+    _accumulate(c._stat_count,c._stat_mean,c._stat_scatter,c._stat_scatter_diag);
+}
+
+void Component::_accumulate(int count, const Eigen::VectorXd& mean, const Eigen::MatrixXd& scatter, const Eigen::VectorXd& scatter_diag){
+    if(count == 0)
+        return;
+    if(_stat_count == 0){
+        _stat_count = count;
+        _stat_mean = mean;
+        _stat_scatter = scatter;
+        _stat_scatter_diag = scatter_diag;
+        return;
+    }
+
+    double n1 = _stat_count, n2 = count, n = n1 + n2;
+    Eigen::VectorXd delta = mean - _stat_mean;
+    _stat_mean += n2/n*delta;
+    if(_covariance_type == FULL)
+        _stat_scatter += scatter + n1*n2/n*delta*delta.transpose();
+    else _stat_scatter_diag += scatter_diag + n1*n2/n*delta.cwiseAbs2();
+    _stat_count += count;
+}
+
+void Component::_remove_from_statistics(const Eigen::VectorXd& sample){
+    if(_stat_count <= 1){
+        _stat_count = 0;
+        return;
+    }
+
+    double n = _stat_count;
+    _stat_mean = (n*_stat_mean - sample)/(n - 1.);
+    Eigen::VectorXd delta = sample - _stat_mean;
+    double coef = (n - 1.)/n;
+    if(_covariance_type == FULL)
+        _stat_scatter.noalias() -= coef*delta*delta.transpose();
+    else _stat_scatter_diag -= coef*delta.cwiseAbs2();
+    _stat_count--;
+}
+
+void Component::remove_sample(int i){
+    _fitted = false;
+    if(_sufficient_statistics)
+        _remove_from_statistics(_samples.col(i));
+    _nb_samples--;
+    if(i != _nb_samples)
+        _samples.col(i) = _samples.col(_nb_samples);
+    _size--;
+}
+
+void Component::_rebuild_statistics(){
+    _stat_count = _nb_samples;
+    _stat_mean = Eigen::VectorXd::Zero(_dimension);
+    _stat_scatter.resize(0,0);
+    _stat_scatter_diag.resize(0);
+    if(_covariance_type == FULL)
+        _stat_scatter = Eigen::MatrixXd::Zero(_dimension,_dimension);
+    else _stat_scatter_diag = Eigen::VectorXd::Zero(_dimension);
+    if(_stat_count == 0)
+        return;
+
+    auto samples = _samples.leftCols(_nb_samples);
+    _stat_mean = 1./_stat_count*samples.rowwise().sum();
+
+    Eigen::MatrixXd centered = samples.colwise() - _stat_mean;
+    if(_covariance_type == FULL)
+        _stat_scatter.noalias() = centered*centered.transpose();
+    else _stat_scatter_diag = centered.cwiseAbs2().rowwise().sum();
+}
 
 void Component::_incr_parameters(const Eigen::VectorXd& X){
     add(X);
-    if(_samples.size() <= 1){
+    _fitted = false;
+    if(_nb_samples <= 1){
         _mu = X;
-        _covariance = Eigen::MatrixXd::Identity(_dimension,_dimension)*COEF;
+        _reset_covariance();
+        _update_factorization();
         return;
     }
-    double f_size = _samples.size();
+    double f_size = _nb_samples;
 
     _mu = (f_size-1)/f_size*_mu + 1/f_size*X;
-    _covariance = (f_size-2)/(f_size-1)*_covariance
-            + f_size/((f_size-1)*(f_size-1))*(X - _mu)*(X - _mu).transpose();
+    if(_covariance_type == FULL){
+        Eigen::VectorXd v = X - _mu;
+        double scale = (f_size-2)/(f_size-1), sigma = f_size/((f_size-1)*(f_size-1));
+        _covariance = scale*_covariance + sigma*v*v.transpose();
+        _update_factorization(scale,v,sigma);
+        return;
+    }
+    else{
+        _variances = (f_size-2)/(f_size-1)*_variances
+                + f_size/((f_size-1)*(f_size-1))*(X - _mu).cwiseAbs2();
+        if(_covariance_type == SPHERICAL)
+            _variances.setConstant(_variances.mean());
+    }
+    _update_factorization();
+}
 
+void Component::_decr_parameters(int i){
+    //the downdate is only exact if the parameters are the sample mean and covariance computed by update_parameters
+    bool downdate = _fitted && _sufficient_statistics && _nb_samples - 1 > 4;
+    Eigen::VectorXd X = _samples.col(i);
+    remove_sample(i);
+    if(!downdate || (_covariance_type == FULL ? _stat_scatter.squaredNorm() : _stat_scatter_diag.squaredNorm()) < 1e-4){
+        if(_nb_samples > 0)
+            update_parameters();
+        return;
+    }
+    double f_size = _nb_samples + 1; //size before the removal
+
+    Eigen::VectorXd v = X - _mu;
+    _mu = (f_size*_mu - X)/(f_size-1);
+    double scale = (f_size-1)/(f_size-2), sigma = f_size/((f_size-1)*(f_size-1));
+    _size = _nb_samples;
+    _fitted = true;
+    if(_covariance_type == FULL){
+        _covariance = scale*(_covariance - sigma*v*v.transpose());
+        _update_factorization(scale,v,-scale*sigma);
+        return;
+    }
+    _variances = scale*(_variances - sigma*v.cwiseAbs2());
+    if(_covariance_type == SPHERICAL)
+        _variances.setConstant(_variances.mean());
+    _update_factorization();
+}
+
+Eigen::MatrixXd Component::get_covariance() const {
+    if(_covariance_type == FULL)
+        return _covariance;
+    return _variances.asDiagonal();
+}
+
+void Component::set_statistics_from_parameters(){
+    if(!_sufficient_statistics || _nb_samples <= 4)
+        return;
+    _stat_count = _nb_samples;
+    _stat_mean = _mu;
+    if(_covariance_type == FULL)
+        _stat_scatter = (_stat_count - 1.)/COEF*_covariance;
+    else _stat_scatter_diag = (_stat_count - 1.)/COEF*_variances;
+    _size = _nb_samples;
+    _fitted = true;
+}
+
+void Component::set_covariance(const Eigen::MatrixXd& covariance){
+    _fitted = false;
+    if(_covariance_type == FULL)
+        _covariance = covariance;
+    else if(_covariance_type == DIAGONAL)
+        _variances = covariance.diagonal();
+    else _variances = Eigen::VectorXd::Constant(_dimension,covariance.diagonal().mean());
+    _update_factorization();
 }
 
-double Component::compute_multivariate_normal_dist(Eigen::VectorXd X) const {
+void Component::_update_factorization(double scale, const Eigen::VectorXd& v, double sigma){
+    _spectrum_valid = false;
+    _stamp = ++_stamp_counter;
+    if(_covariance_type != FULL || _singular || _cholesky.rows() != _dimension || scale <= 0){
+        _update_factorization();
+        return;
+    }
+
+    //rank one update (or downdate if sigma < 0) of the scaled factor sqrt(scale)*L
+    _cholesky *= std::sqrt(scale);
+    Eigen::VectorXd w = std::sqrt(std::fabs(sigma))*v;
+    double sign = sigma < 0 ? -1. : 1.;
+    for(int k = 0; k < _dimension; k++){
+        double Lkk = _cholesky(k,k);
+        double r2 = Lkk*Lkk + sign*w(k)*w(k);
+        if(!(r2 > 0)){ //the covariance is not positive definite anymore
+            _update_factorization();
+            return;
+        }
+        double r = std::sqrt(r2);
+        double c = r/Lkk, s = w(k)/Lkk;
+        _cholesky(k,k) = r;
+        int t = _dimension - k - 1;
+        if(t > 0){
+            _cholesky.col(k).tail(t) = (_cholesky.col(k).tail(t) + sign*s*w.tail(t))/c;
+            w.tail(t) = c*w.tail(t) - s*_cholesky.col(k).tail(t);
+        }
+    }
+    _log_determinant = 2.*_cholesky.diagonal().array().log().sum();
+}
+
+void Component::_update_factorization(){
+    _spectrum_valid = false;
+    _stamp = ++_stamp_counter;
+    if(_covariance_type != FULL){
+        double determinant = 1.;
+        _singular = (_variances.array() <= 0).any();
+        _inverse_variances.resize(_dimension);
+        for(int i = 0; i < _dimension; i++){
+            //same threshold as the pseudo inverse for the singular case
+            if(!_singular || _variances(i) > 1e-4){
+                _inverse_variances(i) = 1./_variances(i);
+                determinant *= _variances(i);
+            }
+            else _inverse_variances(i) = 0;
+        }
+        _log_determinant = _singular ? std::log(determinant) : _variances.array().log().sum();
+        return;
+    }
+
+    Eigen::LLT<Eigen::MatrixXd> llt(_covariance);
+    _singular = llt.info() != Eigen::Success;
+    if(!_singular){
+        _cholesky = llt.matrixL();
+        _log_determinant = 2.*_cholesky.diagonal().array().log().sum();
+        _inverse.resize(0,0);
+        return;
+    }
+
+    //the covariance is not positive definite : fall back on its pseudo inverse
+    _cholesky.resize(0,0);
     double determinant = 1.;
-    Eigen::MatrixXd inverse;
-    covariance_inverse(inverse,determinant);
-    determinant = determinant*2*PI;
-    double exp_arg = -1./2.*((X - _mu).transpose()*inverse).dot(X - _mu);
+    covariance_pseudoinverse(_inverse,determinant);
+    _log_determinant = std::log(determinant);
+}
+
+double Component::compute_multivariate_normal_dist(const Eigen::VectorXd& X) const {
+    return density_from_distance(distance(X));
+}
+
+double Component::density_from_distance(double distance) const {
+    double exp_arg = -1./2.*distance;
     if(exp_arg > 0){
         std::cerr << "The covariance matrix is not positive definite" << std::endl;
 //        exp_arg = -exp_arg;
         return 0;
     }
-    double res = 1/determinant*exp(exp_arg);
+    double res = exp(exp_arg - _log_determinant - std::log(2*PI));
     if(res == res)
         return res;
     else return 0;
 }
 
 
+void Component::compute_log_multivariate_normal_dist(const Eigen::Ref<const Eigen::MatrixXd>& X, Eigen::VectorXd& log_densities) const {
+    distance(X,log_densities);
+    log_densities = -1./2.*log_densities.array() - _log_determinant - std::log(2*PI);
+}
+
+void Component::compute_multivariate_normal_dist(const Eigen::Ref<const Eigen::MatrixXd>& X, Eigen::VectorXd& densities) const {
+    distance(X,densities);
+    for(int i = 0; i < densities.rows(); i++){
+        double exp_arg = -1./2.*densities(i);
+        if(exp_arg > 0){
+            std::cerr << "The covariance matrix is not positive definite" << std::endl;
+            densities(i) = 0;
+            continue;
+        }
+        double res = exp(exp_arg - _log_determinant - std::log(2*PI));
+        densities(i) = res == res ? res : 0;
+    }
+}
+
 void Component::merge(const Component::Ptr c){
 //    Component::Ptr new_c(new Component(*this));
 
-    for(int i = 0; i < c->size(); i++)
-        add(c->get_sample(i));
+    //* if the samples of a component do not represent it (e.g. a component built by the split of IncrementalCollabMM holds no sample),
+    //the parameters of the union are computed by matching the moments of both components weighted by their sizes
+    bool moment_matching = _nb_samples != _size || c->_nb_samples != c->_size || _nb_samples + c->_nb_samples == 0;
+    Eigen::VectorXd mu;
+    Eigen::MatrixXd covariance;
+    double size = _size + c->_size;
+    if(moment_matching){
+        double w1 = size > 0 ? _size/size : 0.5, w2 = 1. - w1;
+        mu = w1*_mu + w2*c->_mu;
+        Eigen::VectorXd d1 = _mu - mu, d2 = c->_mu - mu;
+        covariance = w1*(get_covariance() + d1*d1.transpose()) + w2*(c->get_covariance() + d2*d2.transpose());
+    }
+    //*/
+
+    int n = c->nb_samples();
+    if(n > 0){
+        _reserve(_nb_samples + n);
+        _samples.middleCols(_nb_samples,n) = c->get_samples();
+    }
+    _nb_samples += n;
+    _size += n;
+
+    //the moments of the union are computed in closed form from the moments of both components
+    if(_sufficient_statistics){
+        if(c->_sufficient_statistics && (_covariance_type == FULL) == (c->_covariance_type == FULL))
+            _accumulate(*c);
+        else _rebuild_statistics();
+    }
+
+    if(moment_matching){
+        _size = size;
+        _mu = mu;
+        set_covariance(covariance);
+        return;
+    }
 
     update_parameters();
 
@@ -98,108 +454,152 @@ void Component::merge(const Component::Ptr c){
 Component::Ptr Component::split(){
 //    std::cout << "split" << std::endl;
     _check_samples();
+    int n = _nb_samples;
+    if(n < 2)
+        return NULL;
 
-    //* compute distance matrix between the samples of the components
-    Eigen::MatrixXd m_dist(_samples.size(),_samples.size());
-    for(int i = 0; i < _samples.size(); i++){
-        for(int j = 0; j < _samples.size(); j++){
-            if(i==j){
-                m_dist(i,j) = 1000.;
-                continue;
-            }
-
-            m_dist(i,j) = (_samples[i] - _samples[j]).squaredNorm();
+    auto find = [](std::vector<int>& parent, int i) -> int {
+        while(parent[i] != i){
+            parent[i] = parent[parent[i]];
+            i = parent[i];
         }
+        return i;
+    };
+
+    //* create a graph of minimal distances of the samples and go through each connected nodes with an union-find
+    KDTree tree(get_samples());
+    std::vector<int> parent(n);
+    for(int i = 0; i < n; i++)
+        parent[i] = i;
+    for(int i = 0; i < n; i++){
+        double dist;
+        int j = tree.nearest(_samples.col(i),dist,i); //search the closest sample from the iest sample
+        if(j < 0 || dist > 1000. || (dist == 1000. && i < j)) //the sample is too far from the others, it stays alone
+            continue;
+        int ri = find(parent,i), rj = find(parent,j);
+        if(ri != rj)
+            parent[std::max(ri,rj)] = std::min(ri,rj);
     }
-    //*/
-
-    //* create a graph of minimal distances of the samples
-    Eigen::VectorXd minIndexes(_samples.size());
-    std::multimap<int,int> graph;
-    int r,c;
-    for(int i = 0; i < _samples.size(); i++){
-       m_dist.row(i).minCoeff(&r,&c); //search the closest sample from the iest sample
-       if([&]()-> bool{auto range = graph.equal_range(i);
-               for(auto& it = range.first; it != range.second; it++)
-               if(c == it->second) return false; return true;}()){ //search if this edge already exist  in the graph
-           graph.emplace(i,c);
-           graph.emplace(c,i);
-       }
-       minIndexes(i) = c;
-    }
-    //*/
-
-    //* Go through each connected nodes
-    std::vector<std::vector<int>> indexes;
-    while(!graph.empty())
-    {
-        std::vector<int> tmp_ind;
-        std::function<void(int)> rec = [&](int current_i){
-            for(auto i : tmp_ind)
-                if(i == current_i)
-                    return;
-            tmp_ind.push_back(current_i);
-            auto range = graph.equal_range(current_i);
-            for(auto it = range.first; it != range.second; it++)
-                rec(it->second);
-        };
-        rec(graph.begin()->first);
-
 
-        for(const auto& i : tmp_ind)
-            graph.erase(i);
-
-        indexes.push_back(tmp_ind);
+    //lists of indexes ordered by their smallest index
+    std::vector<int> list_of(n);
+    std::vector<int> root_list(n,-1);
+    int nb_lists = 0;
+    for(int i = 0; i < n; i++){
+        int r = find(parent,i);
+        if(root_list[r] < 0)
+            root_list[r] = nb_lists++;
+        list_of[i] = root_list[r];
     }
     //*/
 
-    if(indexes.size() == 1)//if there only one list of indexes split is aborted
+    if(nb_lists == 1)//if there only one list of indexes split is aborted
         return NULL;
 
-    //*reduce the indexes into list
-    Eigen::MatrixXd means = Eigen::MatrixXd::Zero(_dimension,indexes.size());
-    Eigen::MatrixXd dist(indexes.size(),indexes.size());
-
-    while(indexes.size() > 2)
-    {
-        means = Eigen::MatrixXd::Zero(_dimension,indexes.size());
-        for(size_t k = 0; k < indexes.size(); k++){
-            for(const auto& i : indexes[k]){
-                means.col(k) += _samples[i];
-            }
-            means.col(k) = means.col(k)/(double)indexes[k].size();
-        }
-
-        dist.resize(indexes.size(),indexes.size());
-        for(size_t k = 0; k < indexes.size(); k++){
-            for(size_t j = 0; j < indexes.size(); j++){
-                if(k == j){ dist(k,j) = 100000000000; continue;}
-                dist(k,j) = (means.col(k) - means.col(j)).squaredNorm();
-            }
-        }
+    //*reduce the indexes into two lists by merging iteratively the two lists with the closest means
+    std::vector<Eigen::VectorXd> means(nb_lists,Eigen::VectorXd::Zero(_dimension));
+    std::vector<int> sizes(nb_lists,0);
+    for(int i = 0; i < n; i++){
+        means[list_of[i]] += _samples.col(i);
+        sizes[list_of[i]]++;
+    }
+    std::vector<Eigen::VectorXd> sums = means;
+    for(int k = 0; k < nb_lists; k++)
+        means[k] = means[k]/(double)sizes[k];
+
+    //closest list of each list. Ties are broken with the pair of list indexes to always merge the same pair.
+    //The closest lists are searched in a kd-tree over the means of the surviving lists, in which a merged list is moved.
+    //Only the merged list and the lists whose closest list was merged are searched again : a list which became closer
+    //to the merged one than its recorded closest list is not updated, as the pair is found from the merged list if it is the closest pair.
+    std::vector<bool> alive(nb_lists,true);
+    std::vector<int> closest(nb_lists,-1);
+    std::vector<double> closest_dist(nb_lists,std::numeric_limits<double>::infinity());
+    std::vector<std::vector<int>> closest_of(nb_lists); //lists which recorded each list as their closest one, may be out of date
+    std::vector<int> stamp(nb_lists,0);
+    std::vector<int> merged_into(nb_lists);
+    for(int k = 0; k < nb_lists; k++)
+        merged_into[k] = k;
+    typedef std::tuple<double,int,int,int,int> entry_t; //distance, pair of lists, list, stamp
+    std::priority_queue<entry_t,std::vector<entry_t>,std::greater<entry_t>> heap;
+
+    KDTree means_tree(means);
+    std::vector<int> slot(nb_lists), list_at(nb_lists); //index of each list in the tree and list of each point of the tree
+    for(int k = 0; k < nb_lists; k++)
+        slot[k] = list_at[k] = k;
+    auto remove = [&](int k){
+        int last = list_at.size() - 1;
+        means_tree.remove(slot[k]); //the last point takes the index of the removed one
+        list_at[slot[k]] = list_at[last];
+        slot[list_at[last]] = slot[k];
+        list_at.pop_back();
+    };
+    auto search = [&](int k){
+        closest[k] = list_at[means_tree.nearest(means[k],closest_dist[k],slot[k])];
+        closest_of[closest[k]].push_back(k);
+        stamp[k]++;
+        heap.emplace(closest_dist[k],std::min(k,closest[k]),std::max(k,closest[k]),k,stamp[k]);
+    };
+    for(int k = 0; k < nb_lists; k++)
+        search(k);
+
+    int nb_alive = nb_lists;
+    while(nb_alive > 2){
+        entry_t top = heap.top();
+        heap.pop();
+        int k = std::get<3>(top);
+        if(!alive[k] || std::get<4>(top) != stamp[k] || !alive[closest[k]])
+            continue;
 
-        dist.minCoeff(&r,&c);
-        for(const auto& i : indexes[r]){
-            indexes[c].push_back(i);
+        int lo = std::min(k,closest[k]), hi = std::max(k,closest[k]);
+        sums[lo] += sums[hi];
+        sizes[lo] += sizes[hi];
+        means[lo] = sums[lo]/(double)sizes[lo];
+        alive[hi] = false;
+        merged_into[hi] = lo;
+        nb_alive--;
+        if(nb_alive <= 2)
+            break;
+
+        remove(hi);
+        remove(lo);
+        slot[lo] = means_tree.insert(means[lo]);
+        list_at.push_back(lo);
+
+        std::vector<int> to_search;
+        for(int m : {lo,hi}){
+            for(int j : closest_of[m])
+                if(j != lo && alive[j] && closest[j] == m)
+                    to_search.push_back(j);
+            closest_of[m].clear();
         }
-        indexes.erase(indexes.begin() + r);
-        indexes.shrink_to_fit();
+        std::sort(to_search.begin(),to_search.end()); //a list can be recorded twice
+        to_search.erase(std::unique(to_search.begin(),to_search.end()),to_search.end());
+        search(lo);
+        for(int j : to_search)
+            search(j);
     }
+
+    int first = -1;
+    for(int k = 0; k < nb_lists && first < 0; k++)
+        if(alive[k]) first = k;
+    for(int i = 0; i < n; i++)
+        list_of[i] = find(merged_into,list_of[i]);
     //*/
 
-    Component::Ptr new_c(new Component(_dimension,_label));
+    Component::Ptr new_c(new Component(_dimension,_label,_covariance_type,_sufficient_statistics));
     //    std::cout << "samples size : " << _samples.size() << std::endl;
-    for(int i : indexes[0]){
+    for(int i = 0; i < n; i++){
         //        std::cout << i << " : " << _samples[i] << std::endl;
-        new_c->add(_samples[i]);
+        if(list_of[i] == first)
+            new_c->add(_samples.col(i));
     }
 
-    std::vector<Eigen::VectorXd> cpy_samples = _samples;
-    _samples.clear();
-    for(int i = 0; i < cpy_samples.size(); i++){
-        if([=](int i) -> bool {for(int ind : indexes[1]) {if(i == ind ) return true;} return false;}(i))
-            _samples.push_back(cpy_samples[i]);
+    _nb_samples = 0;
+    for(int i = 0; i < n; i++){
+        if(list_of[i] != first)
+            _samples.col(_nb_samples++) = _samples.col(i);
     }
+    _rebuild_statistics();
 
     update_parameters();
 
@@ -214,7 +614,7 @@ bool Component::intersect(const Component::Ptr comp) const {
     std::cout << "test intersection" << std::endl;
 #endif
     Eigen::VectorXd diff_mu, ellipse_vect1, ellipse_vect2;
-    double n1 = _samples.size(), n2 = comp->get_samples().size(), p = _dimension;
+    double n1 = _nb_samples, n2 = comp->nb_samples(), p = _dimension;
     if(n1 <= p /*|| n2 <= p*/){
 #ifdef VERBOSE
     std::cout << "drop intersection test n < p : " << n1 << " < " << p << std::endl;
@@ -241,83 +641,128 @@ bool Component::intersect(const Component::Ptr comp) const {
 }
 
 double Component::distance(const Eigen::VectorXd& X) const {
-    Eigen::MatrixXd inverse;
-    double determinant;
-    covariance_inverse(inverse,determinant);
-    return ((X - _mu).transpose()*inverse).dot(X - _mu);
+    Eigen::VectorXd diff = X - _mu;
+    if(_covariance_type != FULL)
+        return diff.cwiseAbs2().dot(_inverse_variances);
+    if(_singular)
+        return (diff.transpose()*_inverse).dot(diff);
+    return _cholesky.triangularView<Eigen::Lower>().solve(diff).squaredNorm();
+}
+
+void Component::distance(const Eigen::Ref<const Eigen::MatrixXd>& X, Eigen::VectorXd& distances) const {
+    Eigen::MatrixXd diff = X.colwise() - _mu;
+    if(_covariance_type != FULL){
+        distances = diff.cwiseAbs2().transpose()*_inverse_variances;
+        return;
+    }
+    if(_singular){
+        distances = (diff.array()*(_inverse*diff).array()).colwise().sum().transpose();
+        return;
+    }
+    _cholesky.triangularView<Eigen::Lower>().solveInPlace(diff);
+    distances = diff.colwise().squaredNorm().transpose();
 }
 
 double Component::get_standard_deviation() const{
-    if(_samples.size() <= 1) return 0.;
+    if(_nb_samples <= 1) return 0.;
+    if(_covariance_type != FULL)
+        return _variances.norm();
     return sqrt(_covariance.diagonal().dot(_covariance.diagonal()));
 }
 
 
 double Component::entropy(){
-    return _factor*(-std::log(_factor) + 1./2.*std::log((2.*PI*std::exp(1.)*_covariance).determinant()));
+    return _factor*(-std::log(_factor) + 1./2.*(_dimension*std::log(2.*PI*std::exp(1.)) + _log_determinant));
 }
 
-void Component::compute_eigenvalues(Eigen::VectorXd& eigenvalues, Eigen::MatrixXd& eigenvectors) const {
-    Eigen::EigenSolver<Eigen::MatrixXd> solver(_covariance);
+void Component::_update_spectrum() const {
+    if(_spectrum_valid)
+        return;
 
-    eigenvalues = Eigen::VectorXd(_dimension);
-    for(int i = 0; i < _dimension; i++)
-        eigenvalues(i) = solver.eigenvalues()(i).real();
-    eigenvectors = Eigen::MatrixXd(_dimension,_dimension);
-    for(int i = 0; i < _dimension; i++){
-        for(int j = 0; j < _dimension; j++)
-            eigenvectors(i,j) = solver.eigenvectors()(i,j).real();
+    if(_covariance_type != FULL){
+        _eigenvalues = _variances;
+        _eigenvectors = Eigen::MatrixXd::Identity(_dimension,_dimension);
     }
+    else{
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(_covariance);
+        _eigenvalues = solver.eigenvalues();
+        _eigenvectors = solver.eigenvectors();
+    }
+    _spectrum_valid = true;
+}
+
+void Component::compute_eigenvalues(Eigen::VectorXd& eigenvalues, Eigen::MatrixXd& eigenvectors) const {
+    _update_spectrum();
+    eigenvalues = _eigenvalues;
+    eigenvectors = _eigenvectors;
+}
+
+Eigen::VectorXd Component::principal_axis() const {
+    _update_spectrum();
+    int r,c;
+    _eigenvalues.maxCoeff(&r,&c);
+    return _eigenvectors.col(r);
+}
+
+double Component::condition_number() const {
+    _update_spectrum();
+    double min_val = _eigenvalues.minCoeff();
+    if(min_val <= 0)
+        return std::numeric_limits<double>::infinity();
+    return _eigenvalues.maxCoeff()/min_val;
 }
 
 void Component::covariance_inverse(Eigen::MatrixXd& inverse, double& determinant) const{
-    if(_covariance.determinant() == 0){
-        covariance_pseudoinverse(inverse,determinant);
+    determinant = std::exp(_log_determinant);
+    if(_covariance_type != FULL){
+        inverse = _inverse_variances.asDiagonal();
+        return;
     }
-    else{
-        inverse = _covariance.inverse();
-        determinant = _covariance.determinant();
+    if(_singular){
+        inverse = _inverse;
+        return;
     }
+    inverse = Eigen::MatrixXd::Identity(_dimension,_dimension);
+    _cholesky.triangularView<Eigen::Lower>().solveInPlace(inverse);
+    _cholesky.triangularView<Eigen::Lower>().transpose().solveInPlace(inverse);
 }
 
 void Component::covariance_pseudoinverse(Eigen::MatrixXd& inverse, double& determinant) const{
-    Eigen::JacobiSVD<Eigen::MatrixXd> svd(_covariance, Eigen::ComputeThinU | Eigen::ComputeThinV);
-    Eigen::VectorXd singularVal = svd.singularValues();    
-    Eigen::MatrixXd singularValInv = Eigen::MatrixXd::Zero(_dimension,_dimension);
+    if(_covariance_type != FULL){
+        Eigen::VectorXd inv_var = Eigen::VectorXd::Zero(_dimension);
+        for(int i = 0; i < _dimension; i++){
+            if(std::fabs(_variances(i)) > 1e-4){
+                inv_var(i) = 1./_variances(i);
+                determinant = determinant*std::fabs(_variances(i));
+            }
+        }
+        inverse = inv_var.asDiagonal();
+        return;
+    }
+
+    //the covariance is symmetric : its singular values are the absolute values of its eigenvalues
+    _update_spectrum();
+    Eigen::VectorXd eigenValInv = Eigen::VectorXd::Zero(_dimension);
     for(int i = 0; i < _dimension; i++){
-        if(singularVal(i) > 1e-4){
-            singularValInv(i,i) = 1./singularVal(i);
-            determinant = determinant*singularVal(i);
+        double singularVal = std::fabs(_eigenvalues(i));
+        if(singularVal > 1e-4){
+            eigenValInv(i) = 1./_eigenvalues(i);
+            determinant = determinant*singularVal;
         }
-        if(singularValInv(i,i) != singularValInv(i,i))
-            singularValInv(i,i) = 0;
+        if(eigenValInv(i) != eigenValInv(i))
+            eigenValInv(i) = 0;
     }
-    Eigen::MatrixXd V = svd.matrixV();
-    Eigen::MatrixXd U = svd.matrixU();
-    for(int i = 0; i < V.rows(); i++){
-        for(int j = 0; j < V.cols(); j++){
+    Eigen::MatrixXd V = _eigenvectors;
+    for(int i = 0; i < V.rows(); i++)
+        for(int j = 0; j < V.cols(); j++)
             if(V(i,j) != V(i,j))
                 V(i,j) = 0;
-            if(U(j,i) != U(j,i))
-                U(j,i) = 0;
-        }
-    }
-    inverse = V*singularValInv*U.transpose();
+    inverse = V*eigenValInv.asDiagonal()*V.transpose();
 }
 
 void Component::_check_samples(){
-    for(int i = 0; i < _samples.size(); i++){
-        if(_samples[i].rows() == 0){
-            _samples.erase(_samples.begin() + i);
-            i--;
-            continue;
-        }
-        for(int j = 0; j < _samples[i].rows(); j++){
-            if(_samples[i](j) != _samples[i](j))
-                _samples[i](j) = 0;
-        }
-    }
-    _samples.shrink_to_fit();
+    auto samples = _samples.leftCols(_nb_samples);
+    samples = (samples.array() == samples.array()).select(samples,0.);
 }
 
 std::string Component::print_parameters() const {
@@ -326,7 +771,7 @@ std::string Component::print_parameters() const {
     stream << "lbl : " << _label << std::endl;
     stream << "mu : \n" << _mu << std::endl;
     stream << "factor : " << _factor << std::endl;
-    stream << "size : " << _samples.size() << std::endl;
+    stream << "size : " << _nb_samples << std::endl;
     stream << "standard deviation : " << get_standard_deviation() << std::endl;
     stream << "----------------------" << std::endl;
     return stream.str();
@@ -0,0 +1,153 @@
+#include "cmm/component_index.hpp"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace cmm;
+
+double ComponentIndex::_scale(const Component& comp){
+    if(comp.is_singular())
+        return std::numeric_limits<double>::infinity();
+    if(comp.get_covariance_type() != Component::FULL)
+        return comp.get_variances().maxCoeff();
+
+    //the largest eigenvalue is bounded by the trace and by the largest absolute row sum (Gershgorin)
+    Eigen::MatrixXd covariance = comp.get_covariance();
+    return std::min(covariance.trace(),covariance.cwiseAbs().rowwise().sum().maxCoeff());
+}
+
+void ComponentIndex::clear(){
+    _components.clear();
+    _means.resize(0,0);
+    _scales.clear();
+    _drifts.clear();
+    _leaves.clear();
+    _indexes.clear();
+    _nodes.clear();
+    _nb_updates = 0;
+}
+
+void ComponentIndex::build(const std::vector<Component::Ptr>& components, int leaf_size){
+    clear();
+    _leaf_size = leaf_size < 1 ? 1 : leaf_size;
+    _components = components;
+    int n = _components.size();
+    if(n == 0)
+        return;
+
+    _means.resize(_components[0]->get_mu().rows(),n);
+    _scales.resize(n);
+    _drifts.assign(n,0);
+    _leaves.resize(n);
+    _indexes.resize(n);
+    for(int i = 0; i < n; i++){
+        _means.col(i) = _components[i]->get_mu();
+        _scales[i] = _scale(*_components[i]);
+        _indexes[i] = i;
+    }
+    _nodes.reserve(2*n/_leaf_size + 1);
+    _build(0,n,-1);
+}
+
+int ComponentIndex::_build(int begin, int end, int parent){
+    int id = _nodes.size();
+    _nodes.emplace_back();
+    _node_t& node = _nodes[id];
+    node.begin = begin;
+    node.end = end;
+    node.parent = parent;
+    node.min_pt = _means.col(_indexes[begin]);
+    node.max_pt = node.min_pt;
+    for(int i = begin + 1; i < end; i++){
+        node.min_pt = node.min_pt.cwiseMin(_means.col(_indexes[i]));
+        node.max_pt = node.max_pt.cwiseMax(_means.col(_indexes[i]));
+    }
+
+    int axis;
+    if(end - begin <= _leaf_size || (node.max_pt - node.min_pt).maxCoeff(&axis) <= 0){ //leaf
+        for(int i = begin; i < end; i++)
+            _leaves[_indexes[i]] = id;
+        _refresh(id);
+        return id;
+    }
+
+    //split along the axis of largest spread
+    int mid = begin + (end - begin)/2;
+    std::nth_element(_indexes.begin() + begin, _indexes.begin() + mid, _indexes.begin() + end,
+                     [&](int a, int b) -> bool {return _means(axis,a) < _means(axis,b);});
+    int left = _build(begin,mid,id);
+    int right = _build(mid,end,id);
+    _nodes[id].left = left;
+    _nodes[id].right = right;
+    _refresh(id);
+    return id;
+}
+
+void ComponentIndex::_refresh(int node){
+    _node_t& n = _nodes[node];
+    if(n.left < 0){
+        n.max_scale = 0;
+        n.max_drift = 0;
+        for(int i = n.begin; i < n.end; i++){
+            n.max_scale = std::max(n.max_scale,_scales[_indexes[i]]);
+            n.max_drift = std::max(n.max_drift,_drifts[_indexes[i]]);
+        }
+        return;
+    }
+    n.max_scale = std::max(_nodes[n.left].max_scale,_nodes[n.right].max_scale);
+    n.max_drift = std::max(_nodes[n.left].max_drift,_nodes[n.right].max_drift);
+}
+
+void ComponentIndex::update(int k){
+    _scales[k] = _scale(*_components[k]);
+    _drifts[k] = (_components[k]->get_mu() - _means.col(k)).norm();
+    for(int node = _leaves[k]; node >= 0; node = _nodes[node].parent)
+        _refresh(node);
+    _nb_updates++;
+}
+
+double ComponentIndex::_lower_bound(int node, const Eigen::VectorXd& sample) const{
+    const _node_t& n = _nodes[node];
+    if(std::isinf(n.max_scale))
+        return 0;
+    double dist = (sample.cwiseMax(n.min_pt).cwiseMin(n.max_pt) - sample).norm() - n.max_drift;
+    if(dist <= 0)
+        return 0;
+    return dist*dist/n.max_scale;
+}
+
+int ComponentIndex::nearest(const Eigen::VectorXd& sample, double& distance) const{
+    int best = -1;
+    distance = std::numeric_limits<double>::infinity();
+    if(_nodes.empty())
+        return best;
+    _nearest(0,sample,best,distance);
+    if(best < 0) //every bound or distance is infinite or not a number : first component, as a linear scan
+        best = 0;
+    return best;
+}
+
+void ComponentIndex::_nearest(int node, const Eigen::VectorXd& sample, int& best, double& best_dist) const{
+    const _node_t& n = _nodes[node];
+    if(n.left < 0){
+        for(int i = n.begin; i < n.end; i++){
+            int ind = _indexes[i];
+            double dist = _components[ind]->distance(sample);
+            if(dist < best_dist || (dist == best_dist && ind < best)){
+                best_dist = dist;
+                best = ind;
+            }
+        }
+        return;
+    }
+
+    double left_bound = _lower_bound(n.left,sample);
+    double right_bound = _lower_bound(n.right,sample);
+    int near = left_bound <= right_bound ? n.left : n.right;
+    int far = left_bound <= right_bound ? n.right : n.left;
+    //equidistant components are still visited to keep the smallest index
+    if(std::min(left_bound,right_bound) <= best_dist)
+        _nearest(near,sample,best,best_dist);
+    if(std::max(left_bound,right_bound) <= best_dist)
+        _nearest(far,sample,best,best_dist);
+}
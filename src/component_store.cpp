@@ -0,0 +1,31 @@
+#include "cmm/component_store.hpp"
+#include <algorithm>
+
+using namespace cmm;
+
+void ComponentStore::clear(){
+    _components.clear();
+    _labels.clear();
+    _offsets.clear();
+    _ids.clear();
+    _valid = false;
+}
+
+void ComponentStore::build(const model_t& model){
+    clear();
+    int max_label = model.empty() ? -1 : model.rbegin()->first;
+    _offsets.assign(max_label + 2,0);
+    for(const auto& comps : model){
+        if(comps.first < 0)
+            continue;
+        for(const auto& comp : comps.second){
+            _ids[comp->get_id()] = _components.size();
+            _components.push_back(comp);
+            _labels.push_back(comps.first);
+        }
+        _offsets[comps.first + 1] = _components.size();
+    }
+    for(size_t lbl = 1; lbl < _offsets.size(); lbl++) //labels without components
+        _offsets[lbl] = std::max(_offsets[lbl],_offsets[lbl - 1]);
+    _valid = true;
+}
@@ -3,6 +3,7 @@
 #include <map>
 #include <chrono>
 #include <cmath>
+#include <limits>
 
 
 
@@ -20,6 +21,17 @@ std::vector<double> CollabMM::compute_estimation(const Eigen::VectorXd& X) const
     return estimation<CollabMM>(this,X);
 }
 
+void CollabMM::compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const{
+
+    if([&]() -> bool { for(int i = 0; i < _nbr_class; i++)
+    {if(!_model.at(i).empty()) return false;} return true;}()){
+        estimations = Eigen::MatrixXd::Constant(samples.cols(),_nbr_class,1./(double)_nbr_class);
+        return;
+    }
+
+    estimation<CollabMM>(this,samples,estimations);
+}
+
 
 
 //SCORE_CALCULATOR
@@ -29,7 +41,7 @@ void CollabMM::_score_calculator::operator()(const tbb::blocked_range<size_t>& r
 
     for(size_t i = r.begin(); i != r.end(); ++i){
         if(_samples[i].first == _label || _all_samples)
-            sum += std::log(_samples.estimations[i][_label]);
+            sum += std::log(_samples.estimations(i,_label));
     }
     _sum = sum;
 }
@@ -40,7 +52,7 @@ double CollabMM::_score_calculator::compute(){
     _sum = 0;
     for(int i = 0; i < _samples.size(); i++){
         if(_samples[i].first == _label || _all_samples)
-            _sum += std::log(_samples.estimations[i][_label]);
+            _sum += std::log(_samples.estimations(i,_label));
     }
 #else
     tbb::parallel_reduce(tbb::blocked_range<size_t>(0,_samples.size()),*this);
@@ -50,6 +62,75 @@ double CollabMM::_score_calculator::compute(){
 }
 //--SCORE_CALCULATOR
 
+//EM_STATISTICS
+CollabMM::_em_statistics::_em_statistics(const std::vector<Component::Ptr>& components, const Eigen::MatrixXd& samples,
+                                         std::vector<int>& assignments) :
+    _components(components), _samples(samples), _assignments(assignments){
+    int dim = samples.rows();
+    weights = Eigen::VectorXd::Zero(components.size());
+    first_moments = Eigen::MatrixXd::Zero(dim,components.size());
+    for(const auto& comp : components)
+        second_moments.push_back(Eigen::MatrixXd::Zero(dim,comp->get_covariance_type() == Component::FULL ? dim : 1));
+}
+
+void CollabMM::_em_statistics::accumulate(size_t begin, size_t end){
+    int n = end - begin, nb_comp = _components.size();
+    auto X = _samples.middleCols(begin,n);
+
+    //* E-step : responsibilities of the components from their weighted log-densities.
+    //the normalized gaussian log-density is used so that the M-step gives the maximum likelihood parameters
+    Eigen::MatrixXd resp(n,nb_comp);
+    Eigen::VectorXd distances;
+    double log_2pi = _samples.rows()*std::log(2*PI);
+    for(int k = 0; k < nb_comp; k++){
+        _components[k]->distance(X,distances);
+        resp.col(k) = -1./2.*(distances.array() + _components[k]->get_log_determinant() + log_2pi)
+                + std::log(_components[k]->get_factor());
+    }
+    for(int i = 0; i < n; i++){
+        int best;
+        double max = resp.row(i).maxCoeff(&best);
+        _assignments[begin + i] = best;
+        if(!std::isfinite(max)){ //the sample has no weight
+            resp.row(i).setZero();
+            continue;
+        }
+        resp.row(i) = (resp.row(i).array() - max).exp();
+        double sum = resp.row(i).sum();
+        resp.row(i) /= sum;
+        loglikelihood += max + std::log(sum);
+    }
+    //*/
+
+    weights += resp.colwise().sum().transpose();
+    for(int k = 0; k < nb_comp; k++){
+        Eigen::MatrixXd centered = X.colwise() - _components[k]->get_mu();
+        first_moments.col(k) += centered*resp.col(k);
+        if(second_moments[k].cols() > 1)
+            second_moments[k].noalias() += centered*resp.col(k).asDiagonal()*centered.transpose();
+        else second_moments[k] += centered.cwiseAbs2()*resp.col(k);
+    }
+}
+
+#ifndef NO_PARALLEL
+void CollabMM::_em_statistics::join(const _em_statistics& em){
+    weights += em.weights;
+    first_moments += em.first_moments;
+    for(size_t k = 0; k < second_moments.size(); k++)
+        second_moments[k] += em.second_moments[k];
+    loglikelihood += em.loglikelihood;
+}
+#endif
+
+void CollabMM::_em_statistics::compute(){
+#ifdef NO_PARALLEL
+    accumulate(0,_samples.cols());
+#else
+    tbb::parallel_reduce(tbb::blocked_range<size_t>(0,_samples.cols(),256),*this);
+#endif
+}
+//--EM_STATISTICS
+
 
 
 void CollabMM::update_factors(){
@@ -68,76 +149,124 @@ void CollabMM::_update_factors(int lbl){
     }
 }
 
+void CollabMM::_estimate_training_dataset(){
+    _density_cache.estimate(this,_samples);
+}
+
 void CollabMM::new_component(const Eigen::VectorXd& sample, int label){
-    Component::Ptr component(new Component(_dimension,label));
+    Component::Ptr component(new Component(_dimension,label,_covariance_type,_sufficient_statistics));
     component->add(sample);
     component->update_parameters();
     _model[label].push_back(component);
     update_factors();
+    _update_component_lists();
 }
 
+void CollabMM::set_sufficient_statistics(bool ss){
+    _sufficient_statistics = ss;
+    for(auto& comps : _model)
+        for(auto& comp : comps.second)
+            comp->set_sufficient_statistics(ss);
+}
 
 void CollabMM::knn(const Eigen::VectorXd& center, Data& output, int k){
-    double min_dist, dist;
-    int min_index;
-    Data cpy_samples(_samples);
-    for(int j = 0; j < k; j++){
-        min_dist = sqrt((cpy_samples[0].second - center).transpose()*(cpy_samples[0].second - center));
-        min_index = 0;
-        for(int i = 1; i < cpy_samples.size(); i++){
-            dist =  sqrt((cpy_samples[i].second - center).transpose()*(cpy_samples[i].second - center));
-            if(dist < min_dist){
-                min_index = i;
-                min_dist = dist;
-            }
-        }
-        output.add(cpy_samples[min_index]);
-        cpy_samples.erase(min_index);
-    }
+    std::vector<int> indexes;
+    _samples.knn(center,k,indexes);
+    for(int i : indexes)
+        output.add(_samples[i]);
 }
 
-double CollabMM::confidence(const Eigen::VectorXd& X) const{
-    int size = 0;
-    for(int i = 0; i < _model.size() ; i++){
-        if(_model.at(i).size() < 5)
+void CollabMM::_list_consistent_components(std::vector<Component::Ptr>& components) const{
+    components.clear();
+    for(const auto& comps : _model){
+        if(comps.second.size() < 5)
             continue;
-        size += _model.at(i).size();
+        components.insert(components.end(),comps.second.begin(),comps.second.end());
     }
+}
+
+void CollabMM::_update_component_lists(){
+    _store.build(_model);
+    _list_consistent_components(_consistent_components);
+    _consistent_class_sizes.clear();
+    for(const auto& comps : _model)
+        _consistent_class_sizes.push_back(comps.second.size());
+}
+
+bool CollabMM::_consistent_components_valid() const{
+    if(!_store.is_valid()) //the model was accessed through model() since the last listing, a component may have been swapped
+        return false;
+    if(_consistent_class_sizes.size() != _model.size())
+        return false;
+    size_t i = 0;
+    for(const auto& comps : _model)
+        if(comps.second.size() != _consistent_class_sizes[i++])
+            return false;
+    return true;
+}
+
+double CollabMM::confidence(const Eigen::VectorXd& X) const{
+    bool valid = _consistent_components_valid();
+    std::vector<Component::Ptr> listed; //the model was modified through model() since the last listing
+    if(!valid)
+        _list_consistent_components(listed);
+    const std::vector<Component::Ptr>& components = valid ? _consistent_components : listed;
 
-    if(size == 0)
+    if(components.empty())
         return 0;
 
     //* Look for the closest consistent (size >= 5) component of X
-    Eigen::VectorXd distances(size);
-    int k = 0;
-//    double denominator = 0;
-    for(int i = 0 ; i < _model.size(); i++){
-        for (int j = 0; j < _model.at(i).size(); j++) {
-            if(_model.at(i).size() < 5)
-                continue;
-            distances(k) = _model.at(i).at(j)->distance(X);
-            k++;
+    int closest = 0;
+    double min_dist = components[0]->distance(X);
+    for(size_t k = 1; k < components.size(); k++){
+        double dist = components[k]->distance(X);
+        if(dist < min_dist){
+            min_dist = dist;
+            closest = k;
         }
     }
-    int r=0,c=0;
-    distances.minCoeff(&r,&c);
     //*/
 
-    //* Compute the real indexes of the components in the model
-    int lbl = 0, s = _model.at(lbl).size();
-    while(r >= s){
-        if(s >= 5)
-            r = r - s;
-        lbl++;
-        s = _model.at(lbl).size();
-    }
-    //*/
-
-
+    return components[closest]->density_from_distance(min_dist)/components[closest]->get_peak_density();
+}
 
+void CollabMM::confidence(const Eigen::MatrixXd& samples, Eigen::VectorXd& confidences) const{
+    bool valid = _consistent_components_valid();
+    std::vector<Component::Ptr> listed; //the model was modified through model() since the last listing
+    if(!valid)
+        _list_consistent_components(listed);
+    const std::vector<Component::Ptr>& components = valid ? _consistent_components : listed;
+
+    confidences = Eigen::VectorXd::Zero(samples.cols());
+    if(components.empty())
+        return;
+
+    auto confidence_block = [&](size_t begin, size_t end){
+        Eigen::VectorXd distances, min_dist;
+        std::vector<int> closest(end - begin,0);
+        components[0]->distance(samples.middleCols(begin,end-begin),min_dist);
+        for(size_t k = 1; k < components.size(); k++){
+            components[k]->distance(samples.middleCols(begin,end-begin),distances);
+            for(size_t i = 0; i < end - begin; i++){
+                if(distances(i) < min_dist(i)){
+                    min_dist(i) = distances(i);
+                    closest[i] = k;
+                }
+            }
+        }
+        for(size_t i = 0; i < end - begin; i++)
+            confidences(begin + i) = components[closest[i]]->density_from_distance(min_dist(i))/
+                    components[closest[i]]->get_peak_density();
+    };
 
-    return _model.at(lbl).at(r)->compute_multivariate_normal_dist(X)/
-            _model.at(lbl).at(r)->compute_multivariate_normal_dist(_model.at(lbl).at(r)->get_mu());
+#ifdef NO_PARALLEL
+    confidence_block(0,samples.cols());
+#else
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,samples.cols(),256),
+                      [&](const tbb::blocked_range<size_t>& r){
+        confidence_block(r.begin(),r.end());
+    });
+#endif
 }
 
 
@@ -158,12 +287,10 @@ bool CollabMM::_merge(const Component::Ptr& comp){
         return false;
 
     int lbl = comp->get_label();
-    int ind;
-    for(ind = 0; ind < _model[lbl].size(); ind++)
-        if(_model[lbl][ind].get() == comp.get())
-            break;
-    if(ind == _model[lbl].size())
+    int global = _store.find(comp->get_id());
+    if(global < 0 || _store[global].get() != comp.get()) //comp is not in the model anymore
         return false;
+    int ind = _store.local_index(global);
 
     //* Capture time.
 #ifdef VERBOSE
@@ -173,7 +300,7 @@ bool CollabMM::_merge(const Component::Ptr& comp){
 #endif
     //*/
 
-    CollabMM candidate;
+    Component::Ptr merged;
     double score, candidate_score;
     if(_llhood_drive)
         score = loglikelihood();
@@ -191,6 +318,8 @@ bool CollabMM::_merge(const Component::Ptr& comp){
         distances(j) = comp->distance(_model[lbl][j]->get_mu());
     }
     distances.minCoeff(&r,&c);
+    if(_model[lbl][r] == comp) // no other component is closer than the sentinel distance
+        return false;
     //*/
 //    if(_model[lbl][r]->get_samples().size() < 5)
 //        return false;
@@ -199,16 +328,14 @@ bool CollabMM::_merge(const Component::Ptr& comp){
 
     if(comp->intersect(_model[lbl][r])){// check instersection
         if(_llhood_drive){
-            candidate = CollabMM(_model);
-            candidate.set_samples(_samples);
-            candidate.model()[lbl][ind]->merge(candidate.model()[lbl][r]);
-
-            candidate.model()[lbl].erase(candidate.model()[lbl].begin() + r);
-            candidate.update_factors();
-
-            candidate._estimate_training_dataset();
-
-            candidate_score = candidate.loglikelihood();
+            //only the merged component is built, the other ones are scored from the density cache
+            merged.reset(new Component(*_model[lbl][ind]));
+            merged->merge(_model[lbl][r]);
+            std::vector<Component::ConstPtr> candidate(_model[lbl].begin(),_model[lbl].end());
+            candidate[ind] = merged;
+            candidate.erase(candidate.begin() + r);
+
+            candidate_score = _density_cache.loglikelihood(_samples,lbl,candidate);
 #ifdef VERBOSE
             std::cout << candidate_score << " >? " << score << std::endl;
 #endif
@@ -219,8 +346,10 @@ bool CollabMM::_merge(const Component::Ptr& comp){
 #ifdef VERBOSE
             std::cout << "-_- MERGE _-_" << std::endl;
 #endif
-            _model[lbl][ind]->merge(_model[lbl][r]);
+            if(_llhood_drive) *_model[lbl][ind] = *merged; //keep the scored parameters and their cached densities
+            else _model[lbl][ind]->merge(_model[lbl][r]);
             _model[lbl].erase(_model[lbl].begin() + r);
+            _update_component_lists();
             update_factors();    //* Display time spent for the algorithm.
 
 
@@ -250,14 +379,11 @@ bool CollabMM::_merge(const Component::Ptr& comp){
 
 std::pair<double,double> CollabMM::_coeff_intersection(int ind1, int lbl1, int ind2, int lbl2){
     std::pair<double,double> coeffs;
-    Eigen::VectorXd eigenval, eigenval2, diff_mu;
-    Eigen::MatrixXd eigenvect, eigenvect2;
-    _model[lbl1][ind1]->compute_eigenvalues(eigenval,eigenvect);
-    _model[lbl2][ind2]->compute_eigenvalues(eigenval2,eigenvect2);
+    Eigen::VectorXd diff_mu;
     diff_mu = _model[lbl1][ind1]->get_mu() - _model[lbl1][ind1]->get_mu();
 
-    coeffs.first = diff_mu.dot(eigenvect.col(0)) - diff_mu.squaredNorm()*diff_mu.squaredNorm();
-    coeffs.second = diff_mu.dot(eigenvect2.col(0)) - diff_mu.squaredNorm()*diff_mu.squaredNorm();
+    coeffs.first = diff_mu.dot(_model[lbl1][ind1]->principal_axis()) - diff_mu.squaredNorm()*diff_mu.squaredNorm();
+    coeffs.second = diff_mu.dot(_model[lbl2][ind2]->principal_axis()) - diff_mu.squaredNorm()*diff_mu.squaredNorm();
 
     return coeffs;
 }
@@ -300,11 +426,10 @@ bool CollabMM::_split(const Component::Ptr& comp){
     int lbl = comp->get_label();
     int ind;
     if(_llhood_drive){
-        for(ind = 0; ind < _model[lbl].size(); ind++)
-            if(_model[lbl][ind].get() == comp.get())
-                break;
-        if(ind == _model[lbl].size())
+        int global = _store.find(comp->get_id());
+        if(global < 0 || _store[global].get() != comp.get()) //comp is not in the model anymore
             return false;
+        ind = _store.local_index(global);
     }
     //*/
 
@@ -326,7 +451,7 @@ bool CollabMM::_split(const Component::Ptr& comp){
 
 
     //* Local variables needed for the algorithm
-    CollabMM candidate;
+    Component::Ptr split_comp;
     double cand_score, score;
     //*/
 
@@ -335,80 +460,47 @@ bool CollabMM::_split(const Component::Ptr& comp){
         score = loglikelihood();
 
     //*/
-    int nb_comp = 0;
-    for(const auto & models : _model){
-        if(models.first != lbl)
-            nb_comp += models.second.size();
-    }
-
+    //* Search for the closest component of comp among the components of the other classes, the ones of class lbl are skipped in the store
+    int first = _store.offset(lbl), count = _store.size(lbl);
+    int nb_comp = _store.size() - count;
     Eigen::VectorXd distances(nb_comp);
     int closest_comp_ind, c;
 
-    //* Search for the closest component of comp
-    std::vector<int> labels(nb_comp);
-    std::vector<int> real_ind(nb_comp);
-#ifndef NO_PARALLEL
-    tbb::parallel_for(tbb::blocked_range<size_t>(0,_nbr_class),
-                      [&](tbb::blocked_range<size_t> r){
-        for(int l = r.begin(); l != r.end(); l++){
-#else
-    for(int l = 0; l < _nbr_class; l++){
-#endif
-            if(l == lbl) // only consider models of other classes
-                continue;
-
-            if(_model[l].empty()) // if the model of classes l is empty
-                continue;
-
-        // compute the distances the component candidate for splitting and the components of the model of class l
-
-#ifndef NO_PARALLEL
-            tbb::parallel_for(tbb::blocked_range<size_t>(0,_model[l].size()),
-                              [&](tbb::blocked_range<size_t> s){
-                for(int j = s.begin(); j != s.end(); j++){
+    auto compute_distances = [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; i++)
+            distances(i) = comp->distance(_store[(int)i < first ? i : i + count]->get_mu());
+    };
+#ifdef NO_PARALLEL
+    compute_distances(0,nb_comp);
 #else
-            for (int j = 0; j < _model[l].size(); j++) {
-#endif
-                    int index = 0;
-                    for(int k = 0; k < l; k++)
-                        if(lbl != k)
-                            index += _model[k].size();
-                    index += j;
-                    distances(index) = comp->distance(_model[l][j]->get_mu());
-                    labels[index] = l;
-                    real_ind[index] = j;
-                }
-#ifndef NO_PARALLEL
-            });
-#endif
-
-        }
-#ifndef NO_PARALLEL
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,nb_comp),
+                      [&](const tbb::blocked_range<size_t>& r){
+        compute_distances(r.begin(),r.end());
     });
 #endif
     distances.minCoeff(&closest_comp_ind,&c); // take the indice of the closest component
+    if(closest_comp_ind >= first)
+        closest_comp_ind += count;
     //*/
 
 
-    if(comp->intersect(_model[labels[closest_comp_ind]][real_ind[closest_comp_ind]])){ //if the components intersect
+    if(comp->intersect(_store[closest_comp_ind])){ //if the components intersect
         Component::Ptr new_component;
         int s = comp->size();
 
         if(_llhood_drive){
-            candidate = CollabMM(_model); //Create a model candidate
-            candidate.set_samples(_samples);
-            new_component = candidate.model()[lbl][ind]->split(); //split the component
+            split_comp.reset(new Component(*comp)); //only the split component is copied
+            new_component = split_comp->split(); //split the component
         }else new_component = comp->split();
 
         if(new_component){ //if the component is splitted
             if(_llhood_drive){
-                candidate.model()[lbl].push_back(new_component);
-                candidate.update_factors();
+                std::vector<Component::ConstPtr> candidate(_model[lbl].begin(),_model[lbl].end());
+                candidate[ind] = split_comp;
+                candidate.push_back(new_component);
 
-                candidate._estimate_training_dataset();//estimation for dataset
-
-                //* compute the score of the model candidate
-                cand_score = candidate.loglikelihood();
+                //* compute the score of the model candidate from the density cache
+                cand_score = _density_cache.loglikelihood(_samples,lbl,candidate);
                 //*/
 #ifdef VERBOSE
                 std::cout << "loglikelihood comparison :" << std::endl;
@@ -420,8 +512,9 @@ bool CollabMM::_split(const Component::Ptr& comp){
 #ifdef VERBOSE
                 std::cout << "-_- SPLIT _-_" << std::endl;
 #endif
-                if(_llhood_drive) new_component = comp->split();
+                if(_llhood_drive) *comp = *split_comp; //keep the scored parameters and their cached densities
                 _model[lbl].push_back(new_component);
+                _update_component_lists();
                 update_factors();
 
                 //* Display time spent for the algorithm.
@@ -450,97 +543,98 @@ bool CollabMM::_split(const Component::Ptr& comp){
 }
 
 
-int CollabMM::next_sample(const std::vector<std::pair<Eigen::VectorXd,std::vector<double>>> &samples,
-                     Eigen::VectorXd &choice_dist_map){
-    choice_dist_map = Eigen::VectorXd::Constant(samples.size(),0.5);
-    boost::random::uniform_int_distribution<> dist_uni(0,samples.size()-1);
-
-    if(!skip_bootstrap && _samples.size() <= 10 || !(_use_confidence || _use_uncertainty))
-        return dist_uni(_gen);
-
-    double total = 0,cumul = 0;
-
-    std::vector<double> w(samples.size());
-    boost::random::uniform_real_distribution<> distrib(0,1);
-
-#ifndef NO_PARALLEL
-    tbb::parallel_for(tbb::blocked_range<size_t>(0,choice_dist_map.rows()),
-                      [&](const tbb::blocked_range<size_t>& r){
-#endif
-        //* Search for the class with the less samples in the dataset
-        double est;
-        int min_size = _samples.get_data(0).size(), min_ind = 0;
-        bool all_equal = true;
-        for(int i = 1; i < _nbr_class; i++){
-            int size = _samples.get_data(i).size();
-            all_equal = all_equal && min_size == size;
-            if(min_size > size){
-                min_size = size;
-                min_ind = i;
-            }
-
+int CollabMM::_least_represented_class() const{
+    int min_size = _samples.get_data(0).size(), min_ind = 0;
+    bool all_equal = true;
+    for(int i = 1; i < _nbr_class; i++){
+        int size = _samples.get_data(i).size();
+        all_equal = all_equal && min_size == size;
+        if(min_size > size){
+            min_size = size;
+            min_ind = i;
         }
-        if(all_equal)
-            min_ind = 1; //rand()%_nbr_class;
-        //*/
-
-#ifdef NO_PARALLEL
-        for(size_t i = 0; i < choice_dist_map.rows(); i++){
-#else
-        for(size_t i = r.begin(); i != r.end(); i++){
-#endif
-            est = samples[i].second[min_ind];
-            if(est < 1./(double)_nbr_class)
-                est = -4*est*est*(log(4*est*est)-1);
-            else est = -2*est*(log(2*est)-1);
-
-            if(est < 10e-4)
-                est = 0;
-
-            double c = _use_confidence ? confidence(samples[i].first) : 0;
-            if(c > 1)
-                c = 1;
-            else if (c < 10e-4) c = 0;
-
+    }
+    if(all_equal)
+        min_ind = 1; //rand()%_nbr_class;
+    return min_ind;
+}
 
-            if(!_use_uncertainty)
-                est = 0;
+double CollabMM::_choice_weight(double est, double c) const{
+    if(est < 1./(double)_nbr_class)
+        est = -4*est*est*(log(4*est*est)-1);
+    else est = -2*est*(log(2*est)-1);
+
+    if(est < 10e-4)
+        est = 0;
+
+    if(!_use_confidence)
+        c = 0;
+    if(c > 1)
+        c = 1;
+    else if (c < 10e-4) c = 0;
+
+    if(!_use_uncertainty)
+        est = 0;
+
+    double w = est*(1-c);
+    if(w != w || w < 10e-4)
+        w = 0;
+    else if(w > 1)
+        w = 1;
+    return w;
+}
 
-            w[i] = est*(1-c);
-            if(w[i] != w[i] || w[i] < 10e-4)
-                w[i] = 0;
-            else if(w[i] > 1)
-                w[i] = 1;
-        }
-#ifndef NO_PARALLEL
-    });
-#endif
+int CollabMM::_draw(const Eigen::VectorXd& weights, const Eigen::VectorXd& filter, Eigen::VectorXd& choice_dist_map){
+    boost::random::uniform_int_distribution<> dist_uni(0,weights.rows()-1);
+    boost::random::uniform_real_distribution<> distrib(0,1);
 
-    double max_w = w[0];
-    for(const double& v : w){
-        if(v > max_w)
-            max_w = v;
+    //* the weights are normalised by the largest one
+    double max_w = weights(0);
+    for(int i = 1; i < weights.rows(); i++){
+        if(weights(i) > max_w)
+            max_w = weights(i);
     }
-    for(int i = 0 ; i < w.size(); i++)
-        w[i] = w[i]/max_w;
+    choice_dist_map = (weights/max_w).cwiseProduct(filter);
+    //*/
 
     bool all_zero = true;
+    double total = 0;
     for(int i = 0; i < choice_dist_map.rows(); ++i){
-        choice_dist_map(i) =  w[i];
         all_zero = all_zero && choice_dist_map(i) == 0;
         total += choice_dist_map(i);
     }
     if(all_zero)
         return dist_uni(_gen);
-    double rand_nb = distrib(_gen);
+
+    //* binary search of the first prefix sum above the drawn number
+    std::vector<double> cumul(choice_dist_map.rows());
+    double c = 0;
     for(int i = 0; i < choice_dist_map.rows(); ++i){
-        cumul += choice_dist_map(i);
-        if(rand_nb < cumul/total)
-            return i;
+        c += choice_dist_map(i);
+        cumul[i] = c;
+    }
+    double rand_nb = distrib(_gen);
+    int first = 0, count = cumul.size();
+    while(count > 0){
+        int step = count/2;
+        if(!(rand_nb < cumul[first + step]/total)){
+            first += step + 1;
+            count -= step + 1;
+        }
+        else count = step;
     }
+    if(first < (int)cumul.size())
+        return first;
+    //*/
     return dist_uni(_gen);
 }
 
+int CollabMM::next_sample(const std::vector<std::pair<Eigen::VectorXd,std::vector<double>>> &samples,
+                     Eigen::VectorXd &choice_dist_map){
+    Eigen::VectorXd filter = Eigen::VectorXd::Ones(samples.size());
+    return next_sample(samples,choice_dist_map,filter);
+}
+
 int CollabMM::next_sample(const std::vector<std::pair<Eigen::VectorXd,std::vector<double>>> &samples,
                      Eigen::VectorXd &choice_dist_map, Eigen::VectorXd& filter){
     choice_dist_map = Eigen::VectorXd::Constant(samples.size(),0.5);
@@ -549,113 +643,170 @@ int CollabMM::next_sample(const std::vector<std::pair<Eigen::VectorXd,std::vecto
     if(!skip_bootstrap && _samples.size() <= 10 || !(_use_confidence || _use_uncertainty))
         return dist_uni(_gen);
 
-    double total = 0,cumul = 0;
+    int min_ind = _least_represented_class();
 
-    std::vector<double> w(samples.size());
-    boost::random::uniform_real_distribution<> distrib(0,1);
+    //* confidence of all the candidates at once
+    Eigen::VectorXd confidences = Eigen::VectorXd::Zero(samples.size());
+    if(_use_confidence){
+        Eigen::MatrixXd candidates(_dimension,samples.size());
+        for(size_t i = 0; i < samples.size(); i++)
+            candidates.col(i) = samples[i].first;
+        confidence(candidates,confidences);
+    }
+    //*/
 
-#ifndef NO_PARALLEL
-    tbb::parallel_for(tbb::blocked_range<size_t>(0,choice_dist_map.rows()),
-                      [&](const tbb::blocked_range<size_t>& r){
-#endif
-        //* Search for the class with the less samples in the dataset
-        double est;
-        int min_size = _samples.get_data(0).size(), min_ind = 0;
-        bool all_equal = true;
-        for(int i = 1; i < _nbr_class; i++){
-            int size = _samples.get_data(i).size();
-            all_equal = all_equal && min_size == size;
-            if(min_size > size){
-                min_size = size;
-                min_ind = i;
-            }
+    Eigen::VectorXd weights(samples.size());
+    for(size_t i = 0; i < samples.size(); i++){
+        filter(i) = filter(i) > 10e-4 ? 1 : 0;
+        weights(i) = _choice_weight(samples[i].second[min_ind],confidences(i));
+    }
+    return _draw(weights,filter,choice_dist_map);
+}
+
+int CollabMM::next_sample(const Eigen::MatrixXd& candidates, Eigen::VectorXd& choice_dist_map, int tile_size){
+    choice_dist_map = Eigen::VectorXd::Constant(candidates.cols(),0.5);
+    boost::random::uniform_int_distribution<> dist_uni(0,candidates.cols()-1);
+
+    if(!skip_bootstrap && _samples.size() <= 10 || !(_use_confidence || _use_uncertainty))
+        return dist_uni(_gen);
 
+    int min_ind = _least_represented_class();
+    Eigen::VectorXd weights(candidates.cols());
+
+    //* one distance kernel call per component and per tile gives both the estimation and the confidence
+    auto score_block = [&](size_t begin, size_t end){
+        Eigen::VectorXd distances, min_dist;
+        std::vector<const Component*> closest;
+        for(size_t tile = begin; tile < end; tile += tile_size){
+            size_t size = std::min<size_t>(tile_size,end - tile);
+            Eigen::MatrixXd sums = Eigen::MatrixXd::Zero(size,_nbr_class);
+            min_dist = Eigen::VectorXd::Constant(size,std::numeric_limits<double>::infinity());
+            closest.assign(size,nullptr);
+            for(int lbl = 0; lbl < _nbr_class; lbl++){
+                bool consistent = _model.at(lbl).size() >= 5;
+                for(const auto& comp : _model.at(lbl)){
+                    comp->distance(candidates.middleCols(tile,size),distances);
+                    for(size_t i = 0; i < size; i++){
+                        sums(i,lbl) += comp->get_factor()*comp->density_from_distance(distances(i));
+                        if(consistent && (closest[i] == nullptr || distances(i) < min_dist(i))){
+                            min_dist(i) = distances(i);
+                            closest[i] = comp.get();
+                        }
+                    }
+                }
+            }
+            Eigen::VectorXd sum_of_sums = sums.rowwise().sum();
+            for(size_t i = 0; i < size; i++){
+                double est = (sums(i,min_ind) + 1)/(sum_of_sums(i) + _nbr_class);
+                double c = closest[i] == nullptr ? 0 : closest[i]->density_from_distance(min_dist(i))/closest[i]->get_peak_density();
+                weights(tile + i) = _choice_weight(est,c);
+            }
         }
-        if(all_equal)
-            min_ind = 1; //rand()%_nbr_class;
-        //*/
+    };
+    //*/
 
 #ifdef NO_PARALLEL
-        for(size_t i = 0; i < choice_dist_map.rows(); i++){
+    score_block(0,candidates.cols());
 #else
-        for(size_t i = r.begin(); i != r.end(); i++){
-#endif
-            est = samples[i].second[min_ind];
-            if(est < 1./(double)_nbr_class)
-                est = -4*est*est*(log(4*est*est)-1);
-            else est = -2*est*(log(2*est)-1);
-
-            if(est < 10e-4)
-                est = 0;
-
-            double c = _use_confidence ? confidence(samples[i].first) : 0;
-            if(c > 1)
-                c = 1;
-            else if (c < 10e-4) c = 0;
-
-            if(!_use_uncertainty)
-                est = 0;
-
-            w[i] = est*(1-c);
-            if(w[i] != w[i] || w[i] < 10e-4)
-                w[i] = 0;
-            else if(w[i] > 1)
-                w[i] = 1;
-        }
-#ifndef NO_PARALLEL
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,candidates.cols(),tile_size),
+                      [&](const tbb::blocked_range<size_t>& r){
+        score_block(r.begin(),r.end());
     });
 #endif
 
-    double max_w = w[0];
-    for(const double& v : w){
-        if(v > max_w)
-            max_w = v;
+    return _draw(weights,Eigen::VectorXd::Ones(candidates.cols()),choice_dist_map);
+}
+
+void CollabMM::estimate_features(const std::vector<Eigen::VectorXd> &samples, Eigen::VectorXd& predictions, int lbl){
+    predictions = Eigen::VectorXd::Constant(samples.size(),0.5);
+    if(samples.empty())
+        return;
+
+    Eigen::MatrixXd X(samples[0].rows(),samples.size());
+    for(size_t i = 0; i < samples.size(); i++)
+        X.col(i) = samples[i];
+
+    Eigen::MatrixXd estimations;
+    compute_estimation(X,estimations);
+    predictions = estimations.col(lbl);
+}
+
+std::vector<int> CollabMM::append(const std::vector<Eigen::VectorXd> &samples, const std::vector<int>& lbl){
+    std::vector<int> assignments(samples.size(),0);
+
+    //with a bounded training dataset each new sample may evict another one : the samples are appended one by one
+    if(_dataset_size_max > 0){
+        for(size_t i = 0; i < samples.size(); i++)
+            assignments[i] = append(samples[i],lbl[i]);
+        return assignments;
     }
-    for(int i = 0 ; i < w.size(); i++)
-        w[i] = w[i]/max_w;
 
-    bool all_zero = true;
-    for(int i = 0; i < choice_dist_map.rows(); ++i){
-        if(filter(i) > 10e-4)
-            filter(i) = 1;
-        else filter(i) = 0;
-        choice_dist_map(i) =  w[i]*filter(i);
-        all_zero = all_zero && choice_dist_map(i) == 0;
-        total += choice_dist_map(i);
+    //* the first sample of a class without component creates it, the others are assigned against the model as it is then
+    std::vector<bool> seed(samples.size(),false);
+    for(size_t i = 0; i < samples.size(); i++){
+        _samples.add(lbl[i],samples[i]);
+        if(_model[lbl[i]].empty()){
+            new_component(samples[i],lbl[i]);
+            seed[i] = true;
+        }
     }
-    if(all_zero)
-        return dist_uni(_gen);
-    double rand_nb = distrib(_gen);
-    for(int i = 0; i < choice_dist_map.rows(); ++i){
-        cumul += choice_dist_map(i);
-        if(rand_nb < cumul/total)
-            return i;
+    _stream_size += samples.size();
+
+    for(auto& comps : _model){
+        ComponentIndex& index = _component_index[comps.first];
+        if(!comps.second.empty() && index.is_stale(comps.second))
+            index.build(comps.second);
     }
-    return dist_uni(_gen);
-}
+    //*/
 
-void CollabMM::estimate_features(const std::vector<Eigen::VectorXd> &samples, Eigen::VectorXd& predictions, int lbl){
-    predictions = Eigen::VectorXd::Constant(samples.size(),0.5);
-#ifndef NO_PARALLEL
-    tbb::parallel_for(tbb::blocked_range<size_t>(0,samples.size()),
-                      [&](const tbb::blocked_range<size_t>& r){
-        for(size_t i = r.begin(); i != r.end(); i++){
+    //* closest component of each sample, the indexes are only read
+    auto assign = [&](size_t begin, size_t end){
+        double distance;
+        for(size_t i = begin; i < end; i++)
+            if(!seed[i])
+                assignments[i] = _component_index.at(lbl[i]).nearest(samples[i],distance);
+    };
+#ifdef NO_PARALLEL
+    assign(0,samples.size());
 #else
-    for(size_t i = 0; i < samples.size(); i++){
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,samples.size(),256),
+                      [&](const tbb::blocked_range<size_t>& r){
+        assign(r.begin(),r.end());
+    });
 #endif
-            predictions(i) = compute_estimation(samples[i])[lbl];
-        }
-#ifndef NO_PARALLEL
+    //*/
+
+    //* one update of the statistics and of the parameters per touched component
+    std::map<std::pair<int,int>,std::vector<size_t>> groups;
+    for(size_t i = 0; i < samples.size(); i++)
+        if(!seed[i] && samples[i].rows() > 0)
+            groups[std::make_pair(lbl[i],assignments[i])].push_back(i);
+    std::vector<std::pair<std::pair<int,int>,std::vector<size_t>>> touched(groups.begin(),groups.end());
+
+    auto update_group = [&](size_t g){
+        const std::vector<size_t>& members = touched[g].second;
+        Eigen::MatrixXd block(_dimension,members.size());
+        for(size_t j = 0; j < members.size(); j++)
+            block.col(j) = samples[members[j]];
+        Component::Ptr comp = _model.at(touched[g].first.first)[touched[g].first.second];
+        comp->add_samples(block);
+        comp->update_parameters();
+    };
+#ifdef NO_PARALLEL
+    for(size_t g = 0; g < touched.size(); g++)
+        update_group(g);
+#else
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,touched.size()),
+                      [&](const tbb::blocked_range<size_t>& r){
+        for(size_t g = r.begin(); g != r.end(); g++)
+            update_group(g);
     });
 #endif
-}
+    for(const auto& group : touched)
+        _component_index[group.first.first].update(group.first.second);
+    //*/
 
-void CollabMM::append(const std::vector<Eigen::VectorXd> &samples, const std::vector<int>& lbl){
-    int r,c; //row and column indexes
-    for(int i = 0 ; i < samples.size(); i++){
-        if(!append(samples[i],lbl[i]))
-            continue;
-    }
+    return assignments;
 }
 
 void CollabMM::add(const Eigen::VectorXd &sample, int lbl){
@@ -663,28 +814,117 @@ void CollabMM::add(const Eigen::VectorXd &sample, int lbl){
     _last_label = lbl;
 }
 
+void CollabMM::add(const std::vector<Eigen::VectorXd> &samples, const std::vector<int>& lbl){
+    if(samples.empty())
+        return;
+    _last_index = append(samples,lbl).back();
+    _last_label = lbl.back();
+}
+
 int CollabMM::append(const Eigen::VectorXd &sample,const int& lbl){
-    int r,c; //row and column indexes
+    int r; //index of the closest component
     //    double q = compute_quality(sample,lbl);
 
+    //* bounded memory : a sample is removed before adding a new one to a full training dataset
+    _stream_size++;
+    bool track_arrivals = _dataset_size_max > 0 && _eviction_policy == OLDEST_FIRST;
+    if(track_arrivals && _arrivals.size() != _samples.size()){
+        _arrivals.resize(_samples.size());
+        _positions.resize(_samples.size());
+        for(size_t i = 0; i < _samples.size(); i++)
+            _arrivals[i] = _positions[i] = i;
+        _oldest_arrival = 0;
+    }
+    if(_dataset_size_max > 0 && (int)_samples.size() >= _dataset_size_max){
+        int victim;
+        if(_eviction_policy == OLDEST_FIRST)
+            victim = _pop_oldest_sample();
+        else{
+            //the new sample replaces a random one with probability dataset_size_max/stream_size
+            boost::random::uniform_int_distribution<long> dist(0,_stream_size - 1);
+            long j = dist(_gen);
+            if(j >= _dataset_size_max && !_model[lbl].empty())
+                return _nearest_component(sample,lbl); //the sample is not kept
+            victim = j < _dataset_size_max ? j : j%_dataset_size_max;
+        }
+        _evict(victim);
+    }
+    //*/
+
     _samples.add(lbl,sample);
+    if(track_arrivals){
+        _arrivals.push_back(_oldest_arrival + _positions.size());
+        _positions.push_back(_samples.size() - 1);
+    }
 
     if(_model[lbl].empty()){
         new_component(sample,lbl);
         return 0;
     }
-    Eigen::VectorXd distances(_model[lbl].size());
-
-    for (int j = 0; j < _model[lbl].size(); j++) {
-        distances(j) = _model[lbl][j]->distance(sample);
-    }
-    distances.minCoeff(&r,&c);
+    r = _nearest_component(sample,lbl);
     _model[lbl][r]->add(sample);
     _model[lbl][r]->update_parameters();
+    _component_index[lbl].update(r);
 
     return r;
 }
 
+int CollabMM::_pop_oldest_sample(){
+    int oldest = _positions.front();
+    _positions.pop_front();
+    _oldest_arrival++;
+    //the last sample takes the index of the oldest one at its eviction
+    int last = _samples.size() - 1;
+    if(oldest != last){
+        _arrivals[oldest] = _arrivals[last];
+        _positions[_arrivals[oldest] - _oldest_arrival] = oldest;
+    }
+    _arrivals.pop_back();
+    return oldest;
+}
+
+void CollabMM::_evict(int i){
+    //the components hold the samples with their missing values (NaN) set to 0, see Component::add
+    Eigen::VectorXd sample = _samples[i].second.unaryExpr([](double v) -> double {return v != v ? 0 : v;});
+    int lbl = _samples[i].first;
+    _density_cache.erase(i,_samples.size());
+    _samples.erase(i);
+
+    //* look for the component holding the sample, starting with the closest one
+    std::vector<Component::Ptr>& components = _model[lbl];
+    if(components.empty())
+        return;
+    int closest = _nearest_component(sample,lbl);
+    for(int n = 0; n < (int)components.size(); n++){
+        int k = (closest + n)%components.size();
+        Eigen::Ref<const Eigen::MatrixXd> comp_samples = components[k]->get_samples();
+        for(int j = 0; j < comp_samples.cols(); j++){
+            if(comp_samples.col(j) != sample)
+                continue;
+            if(components[k]->nb_samples() == 1){
+                components.erase(components.begin() + k);
+                _component_index[lbl].clear(); //rebuilt at the next search, it may still reference the removed component
+                _update_factors(lbl);
+                _update_component_lists();
+            }
+            else{
+                components[k]->_decr_parameters(j); //rank one downdate of the parameters
+                _component_index[lbl].update(k);
+            }
+            return;
+        }
+    }
+    //*/
+}
+
+int CollabMM::_nearest_component(const Eigen::VectorXd& sample, int lbl){
+    ComponentIndex& index = _component_index[lbl];
+    if(index.is_stale(_model[lbl]))
+        index.build(_model[lbl]);
+    double distance;
+    return index.nearest(sample,distance);
+}
+
 
 
 void CollabMM::update(){
@@ -694,17 +934,109 @@ void CollabMM::update(){
     if(_update_mode == STOCHASTIC)
         update_model(_last_index,_last_label);
     else update_model();
+    if(_auto_publish)
+        publish();
 }
 
-void CollabMM::update_model(){
-    std::vector<Component::Ptr> comp;
+int CollabMM::refine(int max_iterations, double tolerance){
+    int nb_passes = 0;
+    update_factors();
+    for(auto& model : _model){
+        std::vector<Component::Ptr>& components = model.second;
+        if(components.empty())
+            continue;
 
-    for(int i = 0; i < _nbr_class; i++){
-        for(int j = 0; j < _model[i].size(); j++){
-            comp.push_back(_model[i][j]);
+        //* samples of the class, gathered from its components
+        int nb_samples = 0;
+        for(const auto& comp : components)
+            nb_samples += comp->nb_samples();
+        Eigen::MatrixXd samples(_dimension,nb_samples);
+        nb_samples = 0;
+        for(const auto& comp : components){
+            samples.middleCols(nb_samples,comp->nb_samples()) = comp->get_samples();
+            nb_samples += comp->nb_samples();
+        }
+        std::vector<int> assignments(nb_samples,0);
+        //*/
+
+        double prev_llhood = -std::numeric_limits<double>::infinity();
+        for(int it = 0; it < max_iterations; it++){
+            _em_statistics stats(components,samples,assignments);
+            stats.compute();
+            nb_passes++;
+            if(stats.loglikelihood - prev_llhood <= tolerance*std::fabs(stats.loglikelihood))
+                break;
+            prev_llhood = stats.loglikelihood;
+
+            //* M-step, a component with too few samples keeps its parameters
+            double sum_weights = stats.weights.sum();
+            for(size_t k = 0; k < components.size(); k++){
+                double w = stats.weights(k);
+                if(w <= 4)
+                    continue;
+                Eigen::VectorXd shift = stats.first_moments.col(k)/w;
+                Eigen::MatrixXd covariance;
+                if(stats.second_moments[k].cols() > 1)
+                    covariance = stats.second_moments[k]/w - shift*shift.transpose();
+                else covariance = (stats.second_moments[k]/w - shift.cwiseAbs2()).asDiagonal();
+                if(covariance.squaredNorm() < 1e-4)
+                    continue;
+                components[k]->set_mu(components[k]->get_mu() + shift);
+                components[k]->set_covariance(covariance);
+                components[k]->set_factor(w/sum_weights);
+            }
+            //*/
         }
+
+        //* the samples go to their component of highest responsibility
+        std::vector<std::vector<int>> members(components.size());
+        for(int i = 0; i < nb_samples; i++)
+            members[assignments[i]].push_back(i);
+        std::vector<Component::Ptr> refined;
+        double sum_factors = 0;
+        for(size_t k = 0; k < components.size(); k++){
+            if(members[k].empty())
+                continue;
+            Eigen::MatrixXd block(_dimension,members[k].size());
+            for(size_t j = 0; j < members[k].size(); j++)
+                block.col(j) = samples.col(members[k][j]);
+            Eigen::VectorXd mu = components[k]->get_mu();
+            Eigen::MatrixXd covariance = components[k]->get_covariance();
+            components[k]->clear();
+            components[k]->add_samples(block);
+            components[k]->set_size(members[k].size());
+            components[k]->set_mu(mu);
+            components[k]->set_covariance(covariance);
+            components[k]->set_statistics_from_parameters(); //the refined parameters are kept by the next update_parameters
+            sum_factors += components[k]->get_factor();
+            refined.push_back(components[k]);
+        }
+        for(auto& comp : refined)
+            comp->set_factor(comp->get_factor()/sum_factors);
+        components = refined;
+        //*/
     }
 
+    _component_index.clear();
+    _update_component_lists();
+    if(_auto_publish)
+        publish();
+    return nb_passes;
+}
+
+void CollabMM::publish(){
+    CompiledModel::Ptr snapshot(new CompiledModel(_model,_dimension,_nbr_class));
+    std::atomic_store(&_snapshot,snapshot);
+}
+
+void CollabMM::update_model(){
+    if(!_store.is_valid()) //the model was modified through model()
+        _update_component_lists();
+    std::vector<Component::Ptr> comp = _store.components();
+
+    if(_llhood_drive)
+        update_factors(); //the current model and the candidates of split and merge are scored with the same up to date weights
+
 
     for(int i = 0; i < comp.size(); i++){
 
@@ -719,13 +1051,19 @@ void CollabMM::update_model(){
     for(auto& components : _model)
         for(auto& comp : components.second)
             comp->update_parameters();
+    _component_index.clear();
+    _update_component_lists();
 }
 
 void CollabMM::update_model(int ind, int lbl){
 
     int n,rand_ind/*,max_size,max_ind,min_ind,min_size*/;
-    if(_llhood_drive)
+    if(!_store.is_valid()) //the model was modified through model()
+        _update_component_lists();
+    if(_llhood_drive){
+        update_factors(); //the current model and the candidates of split and merge are scored with the same up to date weights
         _estimate_training_dataset();
+    }
 
     n = _model[lbl].size();
     if(!_split(_model[lbl][ind]) && n > 1)
@@ -750,6 +1088,8 @@ void CollabMM::update_model(int ind, int lbl){
     for(auto& components : _model)
         for(auto& comp : components.second)
             comp->update_parameters();
+    _component_index.clear();
+    _update_component_lists();
 }
 
 
@@ -4,7 +4,7 @@
 using namespace cmm;
 
 void IncrementalCollabMM::add(const Eigen::VectorXd &sample, int lbl){
-    int r,c; //row and column indexes
+    int r; //index of the closest component
 
     _samples.add(lbl,sample);
 
@@ -14,14 +14,10 @@ void IncrementalCollabMM::add(const Eigen::VectorXd &sample, int lbl){
         _last_label = lbl;
         return;
     }
-    Eigen::VectorXd distances(_model[lbl].size());
-
-    for (int j = 0; j < _model[lbl].size(); j++) {
-        distances(j) = _model[lbl][j]->distance(sample);
-    }
-    distances.minCoeff(&r,&c);
+    r = _nearest_component(sample,lbl);
     _model[lbl][r]->_incr_parameters(sample);
     update_factors();
+    _component_index[lbl].update(r);
 
     _last_index = r;
     _last_label = lbl;
@@ -30,6 +26,8 @@ void IncrementalCollabMM::add(const Eigen::VectorXd &sample, int lbl){
 
 void IncrementalCollabMM::update(){
     int n,rand_ind/*,max_size,max_ind,min_ind,min_size*/;
+    if(!_store.is_valid()) //the model was modified through model()
+        _store.build(_model);
     _estimate_training_dataset();
 
 
@@ -49,6 +47,15 @@ void IncrementalCollabMM::update(){
         if(!_split(_model[i][rand_ind]))
             _merge(_model[i][rand_ind]);
     }
+    _component_index.clear();
+}
+
+int IncrementalCollabMM::_nearest_component(const Eigen::VectorXd& sample, int lbl){
+    ComponentIndex& index = _component_index[lbl];
+    if(index.is_stale(_model[lbl]))
+        index.build(_model[lbl]);
+    double distance;
+    return index.nearest(sample,distance);
 }
 
 std::vector<double> IncrementalCollabMM::compute_estimation(const Eigen::VectorXd &X) const{
@@ -59,11 +66,26 @@ std::vector<double> IncrementalCollabMM::compute_estimation(const Eigen::VectorX
     return estimation<IncrementalCollabMM>(this,X);
 }
 
+void IncrementalCollabMM::compute_estimation(const Eigen::MatrixXd& samples, Eigen::MatrixXd& estimations) const{
+    if([&]() -> bool { for(int i = 0; i < _nbr_class; i++){if(!_model.at(i).empty()) return false;} return true;}()){
+        estimations = Eigen::MatrixXd::Constant(samples.cols(),_nbr_class,1./(double)_nbr_class);
+        return;
+    }
+
+    estimation<IncrementalCollabMM>(this,samples,estimations);
+}
+
 void IncrementalCollabMM::new_component(const Eigen::VectorXd& sample, int label){
-    Component::Ptr component(new Component(_dimension,label));
+    Component::Ptr component(new Component(_dimension,label,_covariance_type));
     component->_incr_parameters(sample);
     _model[label].push_back(component);
+    _store.build(_model);
     update_factors();
+
+}
+
+void IncrementalCollabMM::_estimate_training_dataset(){
+    _density_cache.estimate(this,_samples);
 }
 
 void IncrementalCollabMM::update_factors(){
@@ -87,13 +109,10 @@ bool IncrementalCollabMM::_split(const Component::Ptr& comp){
         return false;
     //*/
 
-    //*/ Retrieve the label and the indice of the component
+    //*/ Retrieve the label of the component and check it is still in the model
     int lbl = comp->get_label();
-    int ind;
-    for(ind = 0; ind < _model[lbl].size(); ind++)
-        if(_model[lbl][ind].get() == comp.get())
-            break;
-    if(ind == _model[lbl].size())
+    int global = _store.find(comp->get_id());
+    if(global < 0 || _store[global].get() != comp.get()) //comp is not in the model anymore
         return false;
     //*/
 
@@ -120,53 +139,29 @@ bool IncrementalCollabMM::_split(const Component::Ptr& comp){
 #endif
     //*/
 
-    int nb_comp = 0;
-    for(const auto & models : _model){
-        if(models.first != lbl)
-            nb_comp += models.second.size();
-    }
-
-    //* Search for the closest component of comp
+    //* Search for the closest component of comp among the components of the other classes, the ones of class lbl are skipped in the store
+    int first = _store.offset(lbl), count = _store.size(lbl);
+    int nb_comp = _store.size() - count;
     Eigen::VectorXd distances(nb_comp);
     int closest_comp_ind, c;
-
-    int counter = 0;
-    std::vector<int> labels(nb_comp);
-    std::vector<int> real_ind(nb_comp);
-    for(int l = 0; l < _nbr_class; l++){
-        if(l == lbl) // only consider models of other classes
-            continue;
-
-        if(_model[l].empty()) // if the model of classes l is empty
-            continue;
-
-        // compute the distances the component candidate for splitting and the components of the model of class l
-        for(int j = 0; j < _model[l].size(); j++){
-            distances(counter) = comp->distance(_model[l][j]->get_mu());
-            labels[counter] = l;
-            real_ind[counter] = j;
-            counter++;
-        }
-    }
+    for(int i = 0; i < nb_comp; i++)
+        distances(i) = comp->distance(_store[i < first ? i : i + count]->get_mu());
     distances.minCoeff(&closest_comp_ind,&c); // take the indice of the closest component
+    if(closest_comp_ind >= first)
+        closest_comp_ind += count;
     //*/
 
-    if(comp->intersect(_model[labels[closest_comp_ind]][real_ind[closest_comp_ind]])){
+    if(comp->intersect(_store[closest_comp_ind])){
 #ifdef VERBOSE
                 std::cout << "-_- SPLIT _-_" << std::endl;
 #endif
 
-        Component::Ptr new_component(new Component(_dimension,comp->get_label()));
+        Component::Ptr new_component(new Component(_dimension,comp->get_label(),_covariance_type));
 
-        Eigen::VectorXd eigenvalues;
-        Eigen::MatrixXd eigenvectors;
         Eigen::VectorXd princ_axis;
-        comp->compute_eigenvalues(eigenvalues,eigenvectors);
-        int r,c;
-        eigenvalues.maxCoeff(&r,&c);
-        princ_axis = eigenvectors.col(r)/2.;
-        std::cout << eigenvectors << std::endl;
-        std::cout << eigenvalues << std::endl;
+        princ_axis = comp->principal_axis()/2.;
+        std::cout << comp->get_eigenvectors() << std::endl;
+        std::cout << comp->get_eigenvalues() << std::endl;
         std::cout << std::endl;
 
         std::cout << princ_axis << std::endl << std::endl;
@@ -203,6 +198,7 @@ bool IncrementalCollabMM::_split(const Component::Ptr& comp){
 //        std::cout << comp->get_mu().transpose()*comp->covariance_pseudoinverse()*comp->get_mu() << std::endl;
 
         _model[lbl].push_back(new_component);
+        _store.build(_model);
 
         update_factors();
 
@@ -224,13 +220,10 @@ bool IncrementalCollabMM::_merge(const Component::Ptr &comp){
     if(comp->size() < 5 || _model[comp->get_label()].size() == 1)
         return false;
 
-    // Retrieve indice and label of comp
+    // Retrieve the label of comp and check it is still in the model
     int lbl = comp->get_label();
-    int ind;
-    for(ind = 0; ind < _model[lbl].size(); ind++)
-        if(_model[lbl][ind].get() == comp.get())
-            break;
-    if(ind == _model[lbl].size())
+    int global = _store.find(comp->get_id());
+    if(global < 0 || _store[global].get() != comp.get()) //comp is not in the model anymore
         return false;
 
     //* Capture time.
@@ -252,13 +245,14 @@ bool IncrementalCollabMM::_merge(const Component::Ptr &comp){
         distances(j) = comp->distance(_model[lbl][j]->get_mu());
     }
     distances.minCoeff(&r,&c);
+    if(_model[lbl][r] == comp) // no other component is closer than the sentinel distance
+        return false;
 
     if(comp->intersect(_model[lbl][r])){
-        double w1 = comp->get_factor();
-        double w2 = _model[lbl][r]->get_factor();
-        comp->set_size(comp->size() + _model[lbl][r]->size());
-        update_factors();
-        double w = comp->get_factor();
+        //* the components are matched by their moments, weighted by their sizes
+        double w1 = comp->size();
+        double w2 = _model[lbl][r]->size();
+        double w = w1 + w2;
         Eigen::VectorXd mu1 = comp->get_mu();
         Eigen::VectorXd mu2 = _model[lbl][r]->get_mu();
         Eigen::VectorXd mu = (mu1*w1 + mu2*w2)/w;
@@ -268,10 +262,16 @@ bool IncrementalCollabMM::_merge(const Component::Ptr &comp){
                 w1/w*(covar1 + mu1*mu1.transpose())
                 + w2/w*(covar2 + mu2*mu2.transpose())
                 - mu*mu.transpose();
+        comp->set_size(comp->size() + _model[lbl][r]->size());
         comp->set_mu(mu);
         comp->set_covariance(covar);
+        //*/
         _model[lbl].erase(_model[lbl].begin()+ r);
+        _store.build(_model);
+        update_factors();
+        return true;
     }
+    return false;
 }
 
 double IncrementalCollabMM::confidence(const Eigen::VectorXd &sample) const{return 1;}
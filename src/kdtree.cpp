@@ -0,0 +1,238 @@
+#include "cmm/kdtree.hpp"
+#include <algorithm>
+#include <limits>
+
+using namespace cmm;
+
+void KDTree::build(const std::vector<Eigen::VectorXd>& points, int leaf_size){
+    Eigen::MatrixXd mat(points.empty() ? 0 : points[0].rows(),points.size());
+    for(size_t i = 0; i < points.size(); i++)
+        mat.col(i) = points[i];
+    build(mat,leaf_size);
+}
+
+void KDTree::build(const Eigen::Ref<const Eigen::MatrixXd>& points, int leaf_size){
+    _leaf_size = leaf_size < 1 ? 1 : leaf_size;
+    clear();
+    _points = points;
+    _size = _points.cols();
+    if(_size == 0)
+        return;
+
+    std::vector<int> indexes(_size);
+    for(int i = 0; i < _size; i++)
+        indexes[i] = i;
+    _nodes.reserve(2*_size/_leaf_size + 1);
+    _root = _build(indexes,0,_size);
+}
+
+void KDTree::clear(){
+    _points.resize(_points.rows(),0);
+    _size = 0;
+    _nodes.clear();
+    _free_nodes.clear();
+    _root = -1;
+}
+
+int KDTree::_new_node(){
+    if(_free_nodes.empty()){
+        _nodes.emplace_back();
+        return _nodes.size() - 1;
+    }
+    int id = _free_nodes.back();
+    _free_nodes.pop_back();
+    _nodes[id] = _node_t();
+    return id;
+}
+
+int KDTree::_build(std::vector<int>& indexes, int begin, int end){
+    int id = _new_node();
+    _nodes[id].size = end - begin;
+
+    //split along the axis of largest spread
+    int axis = 0;
+    if(end - begin > _leaf_size){
+        Eigen::VectorXd min_pt = _points.col(indexes[begin]), max_pt = min_pt;
+        for(int i = begin + 1; i < end; i++){
+            min_pt = min_pt.cwiseMin(_points.col(indexes[i]));
+            max_pt = max_pt.cwiseMax(_points.col(indexes[i]));
+        }
+        if((max_pt - min_pt).maxCoeff(&axis) <= 0) //all the points are identical
+            axis = -1;
+    }
+    if(end - begin <= _leaf_size || axis < 0){
+        _nodes[id].indexes.assign(indexes.begin() + begin,indexes.begin() + end);
+        return id;
+    }
+
+    int mid = begin + (end - begin)/2;
+    std::nth_element(indexes.begin() + begin, indexes.begin() + mid, indexes.begin() + end,
+                     [&](int a, int b) -> bool {return _points(axis,a) < _points(axis,b);});
+
+    _nodes[id].axis = axis;
+    _nodes[id].split = _points(axis,indexes[mid]);
+    int left = _build(indexes,begin,mid);
+    int right = _build(indexes,mid,end);
+    _nodes[id].left = left;
+    _nodes[id].right = right;
+    return id;
+}
+
+void KDTree::_collect(int node, std::vector<int>& indexes){
+    const _node_t& n = _nodes[node];
+    if(n.left < 0){
+        indexes.insert(indexes.end(),n.indexes.begin(),n.indexes.end());
+        return;
+    }
+    int left = n.left, right = n.right;
+    _collect(left,indexes);
+    _collect(right,indexes);
+    _free_nodes.push_back(left);
+    _free_nodes.push_back(right);
+}
+
+void KDTree::_rebuild(int node){
+    std::vector<int> indexes;
+    indexes.reserve(_nodes[node].size);
+    _collect(node,indexes);
+    int id = _build(indexes,0,indexes.size());
+    _nodes[node] = std::move(_nodes[id]); //the rebuilt subtree keeps its place in its parent
+    _free_nodes.push_back(id);
+}
+
+int KDTree::insert(const Eigen::VectorXd& point){
+    if(_size == _points.cols())
+        _points.conservativeResize(point.rows(),std::max<int>(2*_points.cols(),16));
+    int ind = _size++;
+    _points.col(ind) = point;
+    if(_root < 0)
+        _root = _new_node();
+
+    //* go down to the leaf of the point and look for the highest unbalanced node on the way
+    int node = _root, scapegoat = -1;
+    while(_nodes[node].left >= 0){
+        _node_t& n = _nodes[node];
+        n.size++;
+        int child = point(n.axis) < n.split ? n.left : n.right;
+        if(scapegoat < 0 && n.size > 2*_leaf_size && 4*(_nodes[child].size + 1) > 3*n.size)
+            scapegoat = node;
+        node = child;
+    }
+    _nodes[node].size++;
+    _nodes[node].indexes.push_back(ind);
+    //*/
+
+    if(scapegoat >= 0)
+        _rebuild(scapegoat);
+    else if(_nodes[node].size > _leaf_size)
+        _rebuild(node); //split the leaf
+    return ind;
+}
+
+bool KDTree::_replace(int node, const Eigen::VectorXd& point, int ind, int new_ind, bool prune){
+    _node_t& n = _nodes[node];
+    if(n.left < 0){
+        auto it = std::find(n.indexes.begin(),n.indexes.end(),ind);
+        if(it == n.indexes.end())
+            return false;
+        if(new_ind >= 0)
+            *it = new_ind;
+        else{
+            *it = n.indexes.back();
+            n.indexes.pop_back();
+            n.size--;
+        }
+        return true;
+    }
+    //the points equal to the split value can be on both sides
+    int left = n.left, right = n.right;
+    bool found = ((!prune || point(n.axis) <= n.split) && _replace(left,point,ind,new_ind,prune)) ||
+            ((!prune || point(n.axis) >= n.split) && _replace(right,point,ind,new_ind,prune));
+    if(found && new_ind < 0)
+        _nodes[node].size--;
+    return found;
+}
+
+void KDTree::remove(int ind){
+    if(ind < 0 || ind >= _size)
+        return;
+    //a point with a missing value (NaN) is not found by the pruned search
+    if(!_replace(_root,_points.col(ind),ind,-1,true))
+        _replace(_root,_points.col(ind),ind,-1,false);
+    int last = _size - 1;
+    if(ind != last){
+        if(!_replace(_root,_points.col(last),last,ind,true))
+            _replace(_root,_points.col(last),last,ind,false);
+        _points.col(ind) = _points.col(last);
+    }
+    _size--;
+}
+
+int KDTree::nearest(const Eigen::VectorXd& query, double& sq_dist, int exclude) const{
+    int best = -1;
+    sq_dist = std::numeric_limits<double>::infinity();
+    if(_root < 0)
+        return best;
+    _nearest(_root,query,exclude,best,sq_dist);
+    return best;
+}
+
+void KDTree::_nearest(int node, const Eigen::VectorXd& query, int exclude, int& best, double& best_dist) const{
+    const _node_t& n = _nodes[node];
+    if(n.left < 0){
+        for(int ind : n.indexes){
+            if(ind == exclude)
+                continue;
+            double dist = (query - _points.col(ind)).squaredNorm();
+            if(dist < best_dist || (dist == best_dist && ind < best)){
+                best_dist = dist;
+                best = ind;
+            }
+        }
+        return;
+    }
+
+    double diff = query(n.axis) - n.split;
+    int near = diff < 0 ? n.left : n.right;
+    int far = diff < 0 ? n.right : n.left;
+    _nearest(near,query,exclude,best,best_dist);
+    if(diff*diff <= best_dist) //equidistant points are still visited to keep the smallest index
+        _nearest(far,query,exclude,best,best_dist);
+}
+
+void KDTree::knn(const Eigen::VectorXd& query, int k, std::vector<int>& indexes, std::vector<double>& sq_dists) const{
+    _heap_t heap;
+    if(k > 0 && _root >= 0)
+        _knn(_root,query,k,heap);
+
+    indexes.resize(heap.size());
+    sq_dists.resize(heap.size());
+    for(int i = heap.size() - 1; i >= 0; i--){
+        sq_dists[i] = heap.top().first;
+        indexes[i] = heap.top().second;
+        heap.pop();
+    }
+}
+
+void KDTree::_knn(int node, const Eigen::VectorXd& query, int k, _heap_t& heap) const{
+    const _node_t& n = _nodes[node];
+    if(n.left < 0){
+        for(int ind : n.indexes){
+            std::pair<double,int> candidate((query - _points.col(ind)).squaredNorm(),ind);
+            if((int)heap.size() < k)
+                heap.push(candidate);
+            else if(candidate < heap.top()){
+                heap.pop();
+                heap.push(candidate);
+            }
+        }
+        return;
+    }
+
+    double diff = query(n.axis) - n.split;
+    int near = diff < 0 ? n.left : n.right;
+    int far = diff < 0 ? n.right : n.left;
+    _knn(near,query,k,heap);
+    if((int)heap.size() < k || diff*diff <= heap.top().first) //equidistant points are still visited to keep the smallest indexes
+        _knn(far,query,k,heap);
+}
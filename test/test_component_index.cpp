@@ -0,0 +1,79 @@
+#include <iostream>
+#include <random>
+#include <limits>
+#include <eigen3/Eigen/Core>
+
+#include <cmm/component.hpp>
+#include <cmm/component_index.hpp>
+
+using namespace cmm;
+
+/**
+ * Check ComponentIndex::nearest against a linear scan of the mahalanobis distances,
+ * after the build and after updates of the parameters of the components.
+ */
+
+int linear_scan(const std::vector<Component::Ptr>& components, const Eigen::VectorXd& sample, double& distance){
+    int best = 0;
+    distance = components[0]->distance(sample);
+    for(size_t k = 1; k < components.size(); k++){
+        double dist = components[k]->distance(sample);
+        if(dist < distance){
+            distance = dist;
+            best = k;
+        }
+    }
+    return best;
+}
+
+int main(){
+    std::mt19937 gen(0);
+    std::normal_distribution<double> normal(0,1);
+    std::uniform_real_distribution<double> uniform(-10,10);
+    int dim = 3;
+    bool ok = true;
+
+    for(auto cov_type : {Component::FULL, Component::DIAGONAL, Component::SPHERICAL}){
+        std::vector<Component::Ptr> components;
+        for(int k = 0; k < 60; k++){
+            Component::Ptr comp(new Component(dim,0,cov_type));
+            Eigen::VectorXd center = Eigen::VectorXd::NullaryExpr(dim,[&](){return uniform(gen);});
+            for(int i = 0; i < 10; i++)
+                comp->add(center + Eigen::VectorXd::NullaryExpr(dim,[&](){return normal(gen);}));
+            comp->update_parameters();
+            components.push_back(comp);
+        }
+
+        ComponentIndex index(components,4);
+        int mismatches = 0;
+        for(int pass = 0; pass < 2; pass++){
+            for(int i = 0; i < 500; i++){
+                Eigen::VectorXd sample = Eigen::VectorXd::NullaryExpr(dim,[&](){return 1.2*uniform(gen);});
+                double distance, expected_distance;
+                int nearest = index.nearest(sample,distance);
+                int expected = linear_scan(components,sample,expected_distance);
+                if(nearest != expected || distance != expected_distance)
+                    mismatches++;
+            }
+            //move some components without rebuilding the index
+            for(int k = 0; k < 20; k++){
+                int j = gen()%components.size();
+                components[j]->add(Eigen::VectorXd::NullaryExpr(dim,[&](){return uniform(gen);}));
+                components[j]->update_parameters();
+                index.update(j);
+            }
+        }
+        std::cout << "nearest covariance type " << cov_type << " : " << mismatches << " mismatches "
+                  << (mismatches == 0 ? "ok" : "FAILED") << std::endl;
+        ok = ok && mismatches == 0;
+
+        //no finite distance : first component, as the linear scan
+        double distance;
+        Eigen::VectorXd sample = Eigen::VectorXd::Constant(dim,std::numeric_limits<double>::quiet_NaN());
+        bool fallback = index.nearest(sample,distance) == 0;
+        std::cout << "nearest without finite distance covariance type " << cov_type << " : " << (fallback ? "ok" : "FAILED") << std::endl;
+        ok = ok && fallback;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <eigen3/Eigen/Core>
+
+#include <cmm/gmm.hpp>
+#include <cmm/density_cache.hpp>
+
+using namespace cmm;
+
+/**
+ * Check the score of DensityCache::loglikelihood against CollabMM::loglikelihood, for the current model
+ * and for a candidate model in which two components of a class are merged.
+ */
+
+bool check(const std::string& name, double error, double tolerance = 1e-8){
+    bool ok = error < tolerance;
+    std::cout << name << " : error " << error << " " << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+//loglikelihood of a model computed by CollabMM from scratch on the given samples
+double reference_loglikelihood(const CollabMM::model_t& model, const Data& samples){
+    CollabMM gmm(model);
+    gmm.set_samples(samples);
+    gmm.update_factors();
+    gmm._estimate_training_dataset();
+    return gmm.loglikelihood();
+}
+
+int main(){
+    srand(0);
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<double> uniform(0,1);
+    std::normal_distribution<double> normal(0,0.05);
+    int dim = 2;
+    std::vector<Eigen::VectorXd> centers;
+    for(int c = 0; c < 8; c++)
+        centers.push_back(Eigen::VectorXd::NullaryExpr(dim,[&](){return uniform(gen);}));
+
+    CollabMM gmm(dim,2);
+    for(int i = 0; i < 400; i++){
+        int c = gen()%centers.size();
+        gmm.add(centers[c] + Eigen::VectorXd::NullaryExpr(dim,[&](){return normal(gen);}),c%2);
+        if(i%20 == 0)
+            gmm.update();
+    }
+    gmm.update_factors();
+    const CollabMM::model_t& model = gmm.model();
+    bool ok = true;
+
+    for(int lbl = 0; lbl < 2; lbl++){
+        Data samples = gmm.get_samples();
+        DensityCache cache;
+        cache.estimate(&gmm,samples);
+
+        //* current model
+        double score = cache.loglikelihood(samples,lbl,model.at(lbl));
+        ok = check("current model, class " + std::to_string(lbl),std::fabs(score - reference_loglikelihood(model,samples))) && ok;
+        //*/
+
+        //* merge of the first two components of the class
+        if(model.at(lbl).size() < 2)
+            continue;
+        Component::Ptr merged(new Component(*model.at(lbl)[0]));
+        merged->merge(model.at(lbl)[1]);
+        std::vector<Component::Ptr> candidate(model.at(lbl).begin(),model.at(lbl).end());
+        candidate[0] = merged;
+        candidate.erase(candidate.begin() + 1);
+        score = cache.loglikelihood(samples,lbl,candidate);
+
+        CollabMM::model_t candidate_model = model;
+        candidate_model[lbl] = candidate;
+        ok = check("merge candidate, class " + std::to_string(lbl),std::fabs(score - reference_loglikelihood(candidate_model,samples))) && ok;
+        //*/
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#include <iostream>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <eigen3/Eigen/Core>
+
+#include <cmm/gmm.hpp>
+
+using namespace cmm;
+
+/**
+ * Check that the eviction of samples from a bounded training dataset removes them from the components too :
+ * the components hold as many samples as the dataset after each step, including with samples with missing values (NaN).
+ * With the OLDEST_FIRST policy the dataset holds the last samples received. Data::knn is checked against a linear scan
+ * after erasures, which move the last sample in place of the erased one.
+ */
+
+bool run(CollabMM::eviction_policy_t policy, const std::string& name){
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<double> uniform(0,1);
+    std::normal_distribution<double> normal(0,0.03);
+    int dim = 3;
+    std::vector<Eigen::VectorXd> centers;
+    for(int c = 0; c < 10; c++)
+        centers.push_back(Eigen::VectorXd::NullaryExpr(dim,[&](){return uniform(gen);}));
+
+    CollabMM gmm(dim,2);
+    gmm.set_dataset_size_max(100);
+    gmm.set_eviction_policy(policy);
+    std::vector<Eigen::VectorXd> stream;
+    for(int i = 0; i < 1000; i++){
+        int c = gen()%centers.size();
+        Eigen::VectorXd sample = centers[c] + Eigen::VectorXd::NullaryExpr(dim,[&](){return normal(gen);});
+        if(i%7 == 0)
+            sample(gen()%dim) = std::numeric_limits<double>::quiet_NaN();
+        gmm.add(sample,c%2);
+        gmm.update();
+        stream.push_back(sample);
+
+        size_t nb_samples = 0;
+        for(const auto& comps : gmm.model())
+            for(const auto& comp : comps.second)
+                nb_samples += comp->nb_samples();
+        if(nb_samples != gmm.get_samples().size()){
+            std::cout << name << " : components hold " << nb_samples << " samples, dataset " << gmm.get_samples().size()
+                      << " after " << i + 1 << " samples FAILED" << std::endl;
+            return false;
+        }
+    }
+
+    if(policy == CollabMM::OLDEST_FIRST){
+        //the samples are compared by their first coordinate, NaN for some of them
+        auto first = [](const Eigen::VectorXd& s) -> double {return s(0) != s(0) ? -1 : s(0);};
+        std::vector<double> kept, expected;
+        const Data& samples = gmm.get_samples();
+        for(size_t i = 0; i < samples.size(); i++)
+            kept.push_back(first(samples[i].second));
+        for(size_t i = stream.size() - 100; i < stream.size(); i++)
+            expected.push_back(first(stream[i]));
+        std::sort(kept.begin(),kept.end());
+        std::sort(expected.begin(),expected.end());
+        if(kept != expected){
+            std::cout << name << " : the dataset does not hold the last samples received FAILED" << std::endl;
+            return false;
+        }
+    }
+    std::cout << name << " : ok" << std::endl;
+    return true;
+}
+
+bool run_knn(){
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<double> uniform(0,1);
+    int dim = 3, k = 5;
+    Data data(dim,1);
+    for(int i = 0; i < 300; i++)
+        data.add(0,Eigen::VectorXd::NullaryExpr(dim,[&](){return uniform(gen);}));
+    std::vector<int> indexes;
+    data.knn(Eigen::VectorXd::Zero(dim),k,indexes); //builds the index
+    int mismatches = 0;
+    for(int i = 0; i < 1000; i++){
+        if(i%2 == 0)
+            data.erase(gen()%data.size());
+        else
+            data.add(0,Eigen::VectorXd::NullaryExpr(dim,[&](){return uniform(gen);}));
+
+        Eigen::VectorXd center = Eigen::VectorXd::NullaryExpr(dim,[&](){return uniform(gen);});
+        data.knn(center,k,indexes);
+        std::vector<std::pair<double,int>> dists;
+        for(int j = 0; j < (int)data.size(); j++)
+            dists.push_back(std::make_pair((data[j].second - center).squaredNorm(),j));
+        std::sort(dists.begin(),dists.end());
+        for(int j = 0; j < k; j++)
+            if(indexes[j] != dists[j].second)
+                mismatches++;
+    }
+    std::cout << "knn after erasures : " << mismatches << " mismatches " << (mismatches == 0 ? "ok" : "FAILED") << std::endl;
+    return mismatches == 0;
+}
+
+int main(){
+    srand(0);
+    bool ok = run(CollabMM::OLDEST_FIRST,"eviction oldest first");
+    ok = run(CollabMM::RESERVOIR,"eviction reservoir") && ok;
+    ok = run_knn() && ok;
+    return ok ? 0 : 1;
+}
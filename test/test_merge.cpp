@@ -0,0 +1,91 @@
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <eigen3/Eigen/Core>
+
+#include <cmm/component.hpp>
+
+using namespace cmm;
+
+/**
+ * Check Component::merge : with samples it is equal to a component fitted on the union of the samples,
+ * without samples (components built by the split of IncrementalCollabMM) it is the moment matching of both components.
+ */
+
+bool check(const std::string& name, double error, double tolerance = 1e-8){
+    bool ok = error < tolerance;
+    std::cout << name << " : error " << error << " " << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+double difference(const Component& c1, const Component& c2){
+    double error = (c1.get_mu() - c2.get_mu()).cwiseAbs().maxCoeff();
+    error = std::max(error,(c1.get_covariance() - c2.get_covariance()).cwiseAbs().maxCoeff());
+    return std::max(error,(double)std::abs(c1.size() - c2.size()));
+}
+
+int main(){
+    std::mt19937 gen(0);
+    std::normal_distribution<double> normal(0,1);
+    int dim = 4;
+    auto random_sample = [&](double offset) -> Eigen::VectorXd {
+        Eigen::VectorXd v(dim);
+        for(int i = 0; i < dim; i++)
+            v(i) = normal(gen) + offset;
+        return v;
+    };
+    bool ok = true;
+
+    //* components holding their samples : same as a fit on the union
+    for(auto cov_type : {Component::FULL, Component::DIAGONAL, Component::SPHERICAL}){
+        Component::Ptr c1(new Component(dim,0,cov_type)), c2(new Component(dim,0,cov_type));
+        Component reference(dim,0,cov_type);
+        for(int i = 0; i < 20; i++){
+            Eigen::VectorXd s1 = random_sample(0), s2 = random_sample(2);
+            c1->add(s1);
+            c2->add(s2);
+            reference.add(s1);
+            reference.add(s2);
+        }
+        c1->update_parameters();
+        c2->update_parameters();
+        reference.update_parameters();
+        c1->merge(c2);
+        ok = check("merge with samples, covariance type " + std::to_string(cov_type),difference(*c1,reference)) && ok;
+    }
+    //*/
+
+    //* components without samples : moment matching
+    auto make = [&](int size, double offset) -> Component::Ptr {
+        Component::Ptr c(new Component(dim,0));
+        Eigen::MatrixXd A = Eigen::MatrixXd::Random(dim,dim);
+        c->set_size(size);
+        c->set_mu(random_sample(offset));
+        c->set_covariance(A*A.transpose() + Eigen::MatrixXd::Identity(dim,dim));
+        return c;
+    };
+    Component::Ptr c1 = make(30,0), c2 = make(10,3);
+    Component reference(dim,0);
+    double w1 = 30./40., w2 = 10./40.;
+    Eigen::VectorXd mu = w1*c1->get_mu() + w2*c2->get_mu();
+    Eigen::VectorXd d1 = c1->get_mu() - mu, d2 = c2->get_mu() - mu;
+    reference.set_size(40);
+    reference.set_mu(mu);
+    reference.set_covariance(w1*(c1->get_covariance() + d1*d1.transpose()) + w2*(c2->get_covariance() + d2*d2.transpose()));
+    c1->merge(c2);
+    ok = check("merge without samples",difference(*c1,reference)) && ok;
+
+    //a component without samples merged into one holding samples keeps its mass
+    Component::Ptr c3(new Component(dim,0));
+    for(int i = 0; i < 20; i++)
+        c3->add(random_sample(0));
+    c3->update_parameters();
+    Component::Ptr c4 = make(20,3);
+    Eigen::VectorXd expected_mu = 0.5*(c3->get_mu() + c4->get_mu());
+    c3->merge(c4);
+    ok = check("merge of a component without samples",(c3->get_mu() - expected_mu).cwiseAbs().maxCoeff()
+               + std::abs(c3->size() - 40)) && ok;
+    //*/
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Cholesky>
+
+#include <cmm/component.hpp>
+
+using namespace cmm;
+
+/**
+ * Check the rank one updates of the parameters against a full recompute :
+ * _incr_parameters against a fresh LLT of the covariance, and _decr_parameters against update_parameters on the remaining samples.
+ */
+
+bool check(const std::string& name, double error, double tolerance = 1e-8){
+    bool ok = error < tolerance;
+    std::cout << name << " : error " << error << " " << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+int main(){
+    std::mt19937 gen(0);
+    std::normal_distribution<double> normal(0,1);
+    int dim = 5;
+    auto random_sample = [&]() -> Eigen::VectorXd {
+        Eigen::VectorXd v(dim);
+        for(int i = 0; i < dim; i++)
+            v(i) = normal(gen)*(i + 1);
+        return v;
+    };
+    bool ok = true;
+
+    //* incremental update of the Cholesky factor against a fresh factorization
+    Component incr(dim,0);
+    for(int i = 0; i < 50; i++)
+        incr._incr_parameters(random_sample());
+    Eigen::LLT<Eigen::MatrixXd> llt(incr.get_covariance());
+    ok = check("incr factor",(incr.get_cholesky() - Eigen::MatrixXd(llt.matrixL())).cwiseAbs().maxCoeff()) && ok;
+    ok = check("incr log determinant",std::fabs(incr.get_log_determinant() -
+                                                2.*Eigen::MatrixXd(llt.matrixL()).diagonal().array().log().sum())) && ok;
+    //*/
+
+    //* decremental update against update_parameters on the remaining samples
+    for(auto cov_type : {Component::FULL, Component::DIAGONAL, Component::SPHERICAL}){
+        Component decr(dim,0,cov_type);
+        for(int i = 0; i < 30; i++)
+            decr.add(random_sample());
+        decr.update_parameters();
+        for(int i = 0; i < 20; i++){
+            int j = gen()%decr.nb_samples();
+            Component reference(decr);
+            reference.remove_sample(j);
+            reference.update_parameters();
+            decr._decr_parameters(j);
+
+            double error = (decr.get_mu() - reference.get_mu()).cwiseAbs().maxCoeff();
+            error = std::max(error,(decr.get_covariance() - reference.get_covariance()).cwiseAbs().maxCoeff());
+            error = std::max(error,std::fabs(decr.get_log_determinant() - reference.get_log_determinant()));
+            if(cov_type == Component::FULL)
+                error = std::max(error,(decr.get_cholesky() - reference.get_cholesky()).cwiseAbs().maxCoeff());
+            error = std::max(error,(double)std::abs(decr.size() - reference.size()));
+            if(!check("decr covariance type " + std::to_string(cov_type) + " size " + std::to_string(decr.nb_samples()),error)){
+                ok = false;
+                break;
+            }
+        }
+    }
+    //*/
+
+    return ok ? 0 : 1;
+}
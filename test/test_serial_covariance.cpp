@@ -0,0 +1,60 @@
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <eigen3/Eigen/Core>
+
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+
+#include <cmm/gmm.hpp>
+#include <cmm/incr_gmm.hpp>
+
+using namespace cmm;
+
+/**
+ * Check that a save/load round trip keeps the covariance type of the model, so that the components created after loading have the same one.
+ */
+
+template <class gmm>
+bool round_trip(Component::covariance_type_t cov_type, const std::string& name){
+    std::mt19937 gen(0);
+    std::normal_distribution<double> normal(0,1);
+    int dim = 3;
+
+    gmm model(dim,2);
+    model.set_covariance_type(cov_type);
+    for(int i = 0; i < 20; i++){
+        Eigen::VectorXd sample(dim);
+        for(int j = 0; j < dim; j++)
+            sample(j) = normal(gen);
+        model.add(sample,0);
+    }
+
+    std::stringstream stream;
+    {
+        boost::archive::text_oarchive oarch(stream);
+        oarch << model;
+    }
+    gmm loaded;
+    {
+        boost::archive::text_iarchive iarch(stream);
+        iarch >> loaded;
+    }
+
+    loaded.add(Eigen::VectorXd::Ones(dim),1); //first component of class 1
+    bool ok = loaded.get_covariance_type() == cov_type;
+    for(const auto& comps : loaded.model())
+        for(const auto& comp : comps.second)
+            ok = ok && comp->get_covariance_type() == cov_type;
+    std::cout << name << " covariance type " << cov_type << " : " << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+int main(){
+    bool ok = true;
+    for(auto cov_type : {Component::FULL, Component::DIAGONAL, Component::SPHERICAL}){
+        ok = round_trip<CollabMM>(cov_type,"CollabMM") && ok;
+        ok = round_trip<IncrementalCollabMM>(cov_type,"IncrementalCollabMM") && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <cmath>
+#include <eigen3/Eigen/Core>
+
+#include <cmm/component.hpp>
+#include <cmm/component_index.hpp>
+
+using namespace cmm;
+
+/**
+ * @brief closest component with the mahalanobis distance by computing the distance to every component, as CollabMM::append did
+ */
+int linear_nearest(const std::vector<Component::Ptr>& components, const Eigen::VectorXd& sample){
+    int r,c;
+    Eigen::VectorXd distances(components.size());
+    for(size_t j = 0; j < components.size(); j++)
+        distances(j) = components[j]->distance(sample);
+    distances.minCoeff(&r,&c);
+    return r;
+}
+
+int main(int argc, char** argv){
+
+    if(argc < 3){
+        std::cout << "usage : dimension, number of components, [number of assignments]" << std::endl;
+        return 1;
+    }
+
+    int dim = std::stoi(argv[1]);
+    int nb_comp = std::stoi(argv[2]);
+    int nb_assign = argc > 3 ? std::stoi(argv[3]) : 10000;
+
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<double> uniform(0,1);
+    std::normal_distribution<double> normal(0,1);
+    auto random_vector = [&](std::function<double()> draw) -> Eigen::VectorXd {
+        Eigen::VectorXd v(dim);
+        for(int i = 0; i < dim; i++)
+            v(i) = draw();
+        return v;
+    };
+
+    //* components fitted on small clusters of samples spread in the unit cube
+    std::vector<Component::Ptr> components;
+    double spread = 0.5/std::pow(nb_comp,1./dim);
+    for(int k = 0; k < nb_comp; k++){
+        Component::Ptr comp(new Component(dim,0));
+        Eigen::VectorXd center = random_vector([&](){return uniform(gen);});
+        for(int i = 0; i < dim + 5; i++)
+            comp->add(center + spread*random_vector([&](){return normal(gen);}));
+        comp->update_parameters();
+        components.push_back(comp);
+    }
+    std::vector<Eigen::VectorXd> samples;
+    for(int i = 0; i < nb_assign; i++)
+        samples.push_back(random_vector([&](){return uniform(gen);}));
+    //*/
+
+    //* assignment of samples to a fixed set of components
+    ComponentIndex index(components);
+    int nb_mismatch = 0;
+    std::vector<int> linear_result(nb_assign), index_result(nb_assign);
+    std::chrono::system_clock::time_point timer = std::chrono::system_clock::now();
+    for(int i = 0; i < nb_assign; i++)
+        linear_result[i] = linear_nearest(components,samples[i]);
+    double linear_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now() - timer).count();
+    double distance;
+    timer = std::chrono::system_clock::now();
+    for(int i = 0; i < nb_assign; i++)
+        index_result[i] = index.nearest(samples[i],distance);
+    double index_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now() - timer).count();
+    for(int i = 0; i < nb_assign; i++)
+        if(linear_result[i] != index_result[i])
+            nb_mismatch++;
+    std::cout << "static | linear " << nb_assign/linear_time*1e6 << " assignments/s | index "
+              << nb_assign/index_time*1e6 << " assignments/s | mismatches " << nb_mismatch << std::endl;
+    //*/
+
+    //* assignment with updates of the components, as in CollabMM::append, on two copies of the components
+    auto assign = [&](bool use_index, std::vector<int>& result) -> double {
+        std::vector<Component::Ptr> comps;
+        for(const auto& comp : components)
+            comps.push_back(Component::Ptr(new Component(*comp)));
+        ComponentIndex idx;
+        std::chrono::system_clock::time_point timer = std::chrono::system_clock::now();
+        for(int i = 0; i < nb_assign; i++){
+            int r;
+            if(use_index){
+                if(idx.is_stale(comps))
+                    idx.build(comps);
+                r = idx.nearest(samples[i],distance);
+            }
+            else r = linear_nearest(comps,samples[i]);
+            comps[r]->add(samples[i]);
+            comps[r]->update_parameters();
+            if(use_index)
+                idx.update(r);
+            result[i] = r;
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now() - timer).count();
+    };
+    linear_time = assign(false,linear_result);
+    index_time = assign(true,index_result);
+    nb_mismatch = 0;
+    for(int i = 0; i < nb_assign; i++)
+        if(linear_result[i] != index_result[i])
+            nb_mismatch++;
+    std::cout << "with updates | linear " << nb_assign/linear_time*1e6 << " assignments/s | index "
+              << nb_assign/index_time*1e6 << " assignments/s | mismatches " << nb_mismatch << std::endl;
+    //*/
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <unistd.h>
+#include <eigen3/Eigen/Core>
+
+#include <boost/archive/text_iarchive.hpp>
+
+#include <cmm/gmm.hpp>
+
+using namespace cmm;
+
+/**
+ * @brief resident memory of the process
+ * @return resident set size in kilobytes, 0 if not available
+ */
+long resident_memory(){
+    std::ifstream ifs("/proc/self/statm");
+    long size = 0, resident = 0;
+    if(!(ifs >> size >> resident))
+        return 0;
+    return resident*sysconf(_SC_PAGESIZE)/1024;
+}
+
+int main(int argc, char** argv){
+
+    if(argc < 3){
+        std::cout << "usage : archive of a CollabMM, dataset file, [number of predictions]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream ifs(argv[1]);
+    if(!ifs.is_open()){
+        std::cerr << "impossible d'ouvrir le fichier : " << argv[1] << std::endl;
+        return 1;
+    }
+    boost::archive::text_iarchive iarch(ifs);
+    CollabMM gmm;
+    iarch >> gmm;
+    ifs.close();
+
+    Data data;
+    int dim, nbr_class;
+    data.load_yml(argv[2],dim,nbr_class);
+    Eigen::MatrixXd samples = data.get_samples_matrix();
+    long nbr_predictions = argc > 3 ? std::stol(argv[3]) : 1000000;
+    long step = nbr_predictions/10 > 0 ? nbr_predictions/10 : 1;
+
+    long initial_memory = resident_memory();
+    std::cout << "predictions | resident memory (kB) | predictions/s" << std::endl;
+    std::cout << 0 << " | " << initial_memory << " | -" << std::endl;
+
+    double sum = 0;
+    Eigen::VectorXd sample;
+    std::chrono::system_clock::time_point timer = std::chrono::system_clock::now();
+    for(long i = 1; i <= nbr_predictions; i++){
+        sample = samples.col(i%samples.cols());
+        sum += gmm.compute_estimation(sample)[0];
+        if(i%step == 0){
+            double time = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now() - timer).count()*1e-6;
+            std::cout << i << " | " << resident_memory() << " | " << step/time << std::endl;
+            timer = std::chrono::system_clock::now();
+        }
+    }
+    if(sum != sum) std::cerr << "invalid estimations" << std::endl;
+
+    std::cout << "memory growth : " << resident_memory() - initial_memory << " kB" << std::endl;
+
+    return 0;
+}
@@ -38,7 +38,7 @@ void write_file(CollabMM& gmm, const std::string file){
             sstream << "component_" << i;
             emitter << YAML::Key << sstream.str() << YAML::Value
                     << YAML::BeginMap //MAP COMPONENT
-                    << YAML::Key << "nb_samples" << YAML::Value << comp->get_samples().size()
+                    << YAML::Key << "nb_samples" << YAML::Value << comp->nb_samples()
                     << YAML::Key << "mean" << YAML::Value
                         << YAML::BeginSeq;
             for(int k = 0; k < comp->get_mu().rows(); k++){
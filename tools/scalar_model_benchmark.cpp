@@ -0,0 +1,124 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <eigen3/Eigen/Core>
+
+#include <boost/archive/text_iarchive.hpp>
+
+#include <cmm/gmm.hpp>
+#include <cmm/scalar_model.hpp>
+#include <cmm/compiled_model.hpp>
+
+using namespace cmm;
+
+/**
+ * @brief time the batch estimation of a model and compare it to reference estimations
+ * @return the number of samples estimated per second
+ */
+template <class model_t>
+double benchmark(const model_t& model, const Eigen::MatrixXd& samples, int repeat,
+                 const Eigen::MatrixXd& reference, double& max_error, double& agreement){
+    Eigen::MatrixXd estimations;
+    std::chrono::system_clock::time_point timer = std::chrono::system_clock::now();
+    for(int i = 0; i < repeat; i++)
+        model.compute_estimation(samples,estimations);
+    double time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now() - timer).count()*1e-6;
+
+    max_error = (estimations - reference).cwiseAbs().maxCoeff();
+    agreement = 0;
+    for(int i = 0; i < estimations.rows(); i++){
+        int estimated, expected;
+        estimations.row(i).maxCoeff(&estimated);
+        reference.row(i).maxCoeff(&expected);
+        if(estimated == expected)
+            agreement += 1;
+    }
+    agreement /= (double)estimations.rows();
+    return repeat*samples.cols()/time;
+}
+
+/**
+ * @brief time the estimation of the samples one by one
+ * @return the number of samples estimated per second
+ */
+template <class model_t>
+double benchmark_single(const model_t& model, const Eigen::MatrixXd& samples, int repeat){
+    double sum = 0;
+    Eigen::VectorXd sample;
+    std::chrono::system_clock::time_point timer = std::chrono::system_clock::now();
+    for(int i = 0; i < repeat; i++){
+        for(int j = 0; j < samples.cols(); j++){
+            sample = samples.col(j);
+            sum += model.compute_estimation(sample)[0];
+        }
+    }
+    double time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now() - timer).count()*1e-6;
+    if(sum != sum) std::cerr << "invalid estimations" << std::endl;
+    return repeat*samples.cols()/time;
+}
+
+int main(int argc, char** argv){
+
+    if(argc < 3){
+        std::cout << "usage : archive of a CollabMM, dataset file, [number of repetitions]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream ifs(argv[1]);
+    if(!ifs.is_open()){
+        std::cerr << "impossible d'ouvrir le fichier : " << argv[1] << std::endl;
+        return 1;
+    }
+    boost::archive::text_iarchive iarch(ifs);
+    CollabMM gmm;
+    iarch >> gmm;
+    ifs.close();
+
+    Data data;
+    int dim, nbr_class;
+    data.load_yml(argv[2],dim,nbr_class);
+    Eigen::MatrixXd samples = data.get_samples_matrix();
+    int repeat = argc > 3 ? std::stoi(argv[3]) : 10;
+
+    ScalarModel<double> double_model(gmm);
+    ScalarModel<float> float_model(gmm);
+    InferenceModel::Ptr fixed_double_model = make_inference_model<double>(gmm);
+    InferenceModel::Ptr fixed_float_model = make_inference_model<float>(gmm);
+    CompiledModel compiled_model(gmm);
+
+    Eigen::MatrixXd reference;
+    gmm.compute_estimation(samples,reference);
+
+    double max_error, agreement;
+    std::cout << "model | batch samples/s | single samples/s | max abs error | argmax agreement" << std::endl;
+    double throughput = benchmark(gmm,samples,repeat,reference,max_error,agreement);
+    std::cout << "CollabMM (double) | " << throughput << " | " << benchmark_single(gmm,samples,repeat)
+              << " | " << max_error << " | " << agreement << std::endl;
+    throughput = benchmark(double_model,samples,repeat,reference,max_error,agreement);
+    std::cout << "ScalarModel<double> | " << throughput << " | " << benchmark_single(double_model,samples,repeat)
+              << " | " << max_error << " | " << agreement << std::endl;
+    throughput = benchmark(float_model,samples,repeat,reference,max_error,agreement);
+    std::cout << "ScalarModel<float> | " << throughput << " | " << benchmark_single(float_model,samples,repeat)
+              << " | " << max_error << " | " << agreement << std::endl;
+    throughput = benchmark(compiled_model,samples,repeat,reference,max_error,agreement);
+    std::cout << "CompiledModel | " << throughput << " | " << benchmark_single(compiled_model,samples,repeat)
+              << " | " << max_error << " | " << agreement << std::endl;
+    if(dim <= 8){
+        throughput = benchmark(*fixed_double_model,samples,repeat,reference,max_error,agreement);
+        std::cout << "ScalarModel<double," << dim << "> | " << throughput << " | " << benchmark_single(*fixed_double_model,samples,repeat)
+                  << " | " << max_error << " | " << agreement << std::endl;
+        throughput = benchmark(*fixed_float_model,samples,repeat,reference,max_error,agreement);
+        std::cout << "ScalarModel<float," << dim << "> | " << throughput << " | " << benchmark_single(*fixed_float_model,samples,repeat)
+                  << " | " << max_error << " | " << agreement << std::endl;
+    }
+
+    double confidence_error = 0;
+    for(int i = 0; i < samples.cols(); i++)
+        confidence_error = std::max(confidence_error,std::fabs(compiled_model.confidence(samples.col(i)) - gmm.confidence(samples.col(i))));
+    std::cout << "CompiledModel confidence max abs error : " << confidence_error << std::endl;
+
+    return 0;
+}